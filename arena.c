@@ -0,0 +1,163 @@
+// arena.c ... per-query memory arenas
+// part of Multi-attribute Linear-hashed Files
+// Manage creating and using Arena objects
+
+#include "defs.h"
+#include "arena.h"
+
+// An Arena hands out memory for the life of one query (or one run
+// of inserts) by bumping a pointer through large chunks, which are
+// the only things malloc'd; nothing is freed on its own, but
+// arenaReset() empties the arena (keeping its first chunk for
+// reuse), and freeArena() releases the lot in one go
+//
+// Page buffers come from the chunks too, PAGESIZE-aligned (so they
+// can be used for O_DIRECT I/O); they are the one thing that can be
+// given back early: arenaFreePage() puts a page on a free list, and
+// arenaPage() reuses it, so a scan cycles through a few buffers
+//
+// An arena counts the allocations it serves and the chunks it
+// mallocs (see arenaAllocs() and arenaMallocs())
+
+#define ALIGN      8    // alignment of arenaAlloc() memory
+
+typedef struct Chunk {
+	struct Chunk *next;    // older chunk
+	size_t   size;         // bytes, including this header
+} Chunk;
+
+struct ArenaRep {
+	size_t   chunk;        // size of a new chunk
+	Chunk   *chunks;       // newest first
+	char    *next;         // free space in the newest chunk
+	char    *end;
+	void    *freePages;    // pages given back (linked through their first word)
+	uint64_t nallocs;      // allocations served
+	uint64_t nmallocs;     // chunks malloc'd
+};
+
+static void *carve(Arena a, size_t n, size_t align);
+
+
+// create an empty arena that mallocs chunk bytes at a time
+// (a chunk holds at least one page)
+
+Arena newArena(size_t chunk)
+{
+	Arena a = malloc(sizeof(struct ArenaRep));
+	assert(a != NULL);
+	a->chunk = (chunk < 2*PAGESIZE) ? 2*PAGESIZE : chunk;
+	a->chunks = NULL;
+	a->next = a->end = NULL;
+	a->freePages = NULL;
+	a->nallocs = a->nmallocs = 0;
+	return a;
+}
+
+// n bytes of memory, good until the arena is reset or freed
+
+void *arenaAlloc(Arena a, size_t n)
+{
+	a->nallocs++;
+	return carve(a, n, ALIGN);
+}
+
+// a copy of string s in the arena
+
+char *arenaString(Arena a, char *s)
+{
+	size_t n = strlen(s) + 1;
+	char *c = arenaAlloc(a, n);
+	memcpy(c, s, n);
+	return c;
+}
+
+// an (uninitialised) page buffer
+
+Page arenaPage(Arena a)
+{
+	a->nallocs++;
+	if (a->freePages != NULL) {
+		void *p = a->freePages;
+		a->freePages = *(void **)p;
+		return p;
+	}
+	return carve(a, PAGESIZE, PAGESIZE);
+}
+
+// a buffer for n consecutive pages (e.g. for readRun()); unlike
+// arenaPage() buffers, it can't be given back early
+
+Page arenaPages(Arena a, Count n)
+{
+	a->nallocs++;
+	return carve(a, (size_t)n*PAGESIZE, PAGESIZE);
+}
+
+// give back a page buffer from arenaPage(), for reuse
+
+void arenaFreePage(Arena a, Page p)
+{
+	*(void **)p = a->freePages;
+	a->freePages = p;
+}
+
+// forget everything allocated; the first chunk is kept
+
+void arenaReset(Arena a)
+{
+	if (a->chunks == NULL) return;
+	while (a->chunks->next != NULL) {
+		Chunk *c = a->chunks;
+		a->chunks = c->next;
+		free(c);
+	}
+	a->next = (char *)a->chunks + sizeof(Chunk);
+	a->end = (char *)a->chunks + a->chunks->size;
+	a->freePages = NULL;
+}
+
+uint64_t arenaAllocs(Arena a) { return a->nallocs; }
+uint64_t arenaMallocs(Arena a) { return a->nmallocs; }
+
+// release an arena and everything in it
+
+void freeArena(Arena a)
+{
+	while (a->chunks != NULL) {
+		Chunk *c = a->chunks;
+		a->chunks = c->next;
+		free(c);
+	}
+	free(a);
+}
+
+
+
+// take n bytes, aligned to align, from the newest chunk,
+// starting a new chunk if there isn't room
+// (chunks are PAGESIZE-aligned, so any page fits in a new one)
+
+static void *carve(Arena a, size_t n, size_t align)
+{
+	if (a->next != NULL) {
+		char *p = (char *)(((uintptr_t)a->next + align - 1) & ~(uintptr_t)(align - 1));
+		if (p + n <= a->end) {
+			a->next = p + n;
+			return p;
+		}
+	}
+	size_t size = sizeof(Chunk) + n + align;
+	if (size < a->chunk) size = a->chunk;
+	void *mem = NULL;
+	int ok = posix_memalign(&mem, PAGESIZE, size);
+	assert(ok == 0 && mem != NULL);
+	a->nmallocs++;
+	Chunk *c = mem;
+	c->size = size;
+	c->next = a->chunks;
+	a->chunks = c;
+	a->next = (char *)c + sizeof(Chunk);
+	a->end = (char *)c + size;
+	return carve(a, n, align);
+}
@@ -0,0 +1,24 @@
+// arena.h ... interface to per-query memory arenas
+// part of Multi-attribute Linear-hashed Files
+// See arena.c for details of Arena type and functions
+
+#ifndef ARENA_H
+#define ARENA_H 1
+
+typedef struct ArenaRep *Arena;
+
+#include "defs.h"
+#include "page.h"
+
+Arena newArena(size_t chunk);
+void *arenaAlloc(Arena a, size_t n);
+char *arenaString(Arena a, char *s);
+Page arenaPage(Arena a);
+Page arenaPages(Arena a, Count n);
+void arenaFreePage(Arena a, Page p);
+void arenaReset(Arena a);
+uint64_t arenaAllocs(Arena a);
+uint64_t arenaMallocs(Arena a);
+void freeArena(Arena a);
+
+#endif
@@ -1,6 +1,6 @@
 // bits.c ... functions on bit-strings
 // part of Multi-attribute Linear-hashed Files
-// Bit-strings are 32-bit unsigned quantities
+// Bit-strings are 64-bit unsigned quantities
 // Last modified by John Shepherd, July 2019
 
 #include <assert.h>
@@ -10,8 +10,8 @@
 
 int bitIsSet(Bits val, int position)
 {
-	assert(0 <= position && position <= 31);
-	Bits mask = (1 << position);
+	assert(0 <= position && position <= 63);
+	Bits mask = ((Bits)1 << position);
 	return ((val & mask) != 0);
 }
 
@@ -19,8 +19,8 @@ int bitIsSet(Bits val, int position)
 
 Bits setBit(Bits val, int position)
 {
-	assert(0 <= position && position <= 31);
-	Bits mask = (1 << position);
+	assert(0 <= position && position <= 63);
+	Bits mask = ((Bits)1 << position);
 	return (val | mask);
 }
 
@@ -28,8 +28,8 @@ Bits setBit(Bits val, int position)
 
 Bits unsetBit(Bits val, int position)
 {
-	assert(0 <= position && position <= 31);
-	Bits mask = (~(1 << position));
+	assert(0 <= position && position <= 63);
+	Bits mask = (~((Bits)1 << position));
 	return (val & mask);
 }
 
@@ -37,19 +37,18 @@ Bits unsetBit(Bits val, int position)
 
 Bits getLower(Bits b, int n)
 {
-	assert(1 <= n && n <= 32);
-	int i; Bits mask = 0;
-	for (i = 0; i < n; i++) mask |= (1<<i);
+	assert(1 <= n && n <= 64);
+	Bits mask = (n == 64) ? ~(Bits)0 : ((Bits)1 << n) - 1;
 	return b&mask;
 }
 
-// convert 32-bit unsigned quantity to string
-// place in a user-supplied buffer of length > 36
+// convert 64-bit unsigned quantity to string
+// place in a user-supplied buffer of length > 72
 
 void bitsString(Bits val, char *buf)
 {
 	int i,j; char ch;
-	Bits bit = 0x80000000;
+	Bits bit = (Bits)1 << 63;
 
 	i = j = 0;
 	while (bit != 0) {
@@ -11,8 +11,8 @@
 
 // convert a a,b:a,b:a,b:...:a,b" representation
 //  of a choice vector into a ChVec
-// if string doesn't specify all 32 bits, then
-//  cycle through attributes until reach 32 bits
+// if string doesn't specify all MAXCHVEC bits, then
+//  cycle through attributes until reach MAXCHVEC bits
 
 Status parseChVec(Reln r, char *str, ChVec cv)
 {
@@ -25,7 +25,7 @@ Status parseChVec(Reln r, char *str, ChVec cv)
 			n = sscanf(c0, "%d,%d", &a, &b);
 			// is the (attr,bit) pair valid?
 			// neither a nor b can be < 0 because they're unsigned
-			if (n != 2 || a >= nattr || b >= 32) {
+			if (n != 2 || a >= nattr || b >= MAXBITS) {
 				printf("Invalid choice vector element: (att:%d,bit:%d)\n",a,b);
 				return ~OK;
 			}
@@ -33,7 +33,7 @@ Status parseChVec(Reln r, char *str, ChVec cv)
 		else {
 			*c = '\0';
 			n = sscanf(c0, "%d,%d", &a, &b);
-			if (n != 2 || a >= nattr || b >= 32) {
+			if (n != 2 || a >= nattr || b >= MAXBITS) {
 				printf("Invalid choice vector element: (att:%d,bit:%d)\n",a,b);
                 return ~OK;
             }
@@ -43,11 +43,11 @@ Status parseChVec(Reln r, char *str, ChVec cv)
 		printf("cv[%d] is (%d,%d)\n", i, cv[i].att, cv[i].bit);
 		i++;
 	}
-	// get enough bits for a 32-bit choice vector
+	// get enough bits for a full (MAXCHVEC-bit) choice vector
 	// take new bits from top end of each hash,
 	//   so as to hopefully not conflict 
 	Count x;  Count next[MAXCHVEC];
-	for (x = 0; x < MAXCHVEC; x++) next[x] = 31;
+	for (x = 0; x < MAXCHVEC; x++) next[x] = MAXBITS-1;
 	x = 0;
 	while (i < MAXCHVEC) {
 		cv[i].att = x; cv[i].bit = next[x];
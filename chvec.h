@@ -11,7 +11,7 @@
 #include "defs.h"
 #include "reln.h"
 
-#define MAXCHVEC 32
+#define MAXCHVEC MAXBITS
 
 typedef struct _ChVecItem { Byte att; Byte bit; } ChVecItem;
 
@@ -0,0 +1,476 @@
+// cvadvise.c ... choice vector advice and relation rebuilds
+// part of Multi-attribute Linear-hashed Files
+// Propose a choice vector that spreads a relation's tuples evenly
+
+#include <math.h>
+#include <stdio.h>
+#include "defs.h"
+#include "cvadvise.h"
+#include "reln.h"
+#include "page.h"
+#include "select.h"
+#include "tuple.h"
+#include "chvec.h"
+#include "hash.h"
+#include "bits.h"
+
+// Linear hashing only spreads tuples evenly if every choice vector
+// bit splits them evenly; a bit taken from an attribute with few
+// distinct values (or from a bit of its hash already used) leaves
+// some buckets with most of the tuples, and their overflow chains
+// grow however many times the relation splits
+//
+// adviseChVec() takes a uniform sample of tuples (reservoir
+// sampling, over a sequential scan of the relation or over a file
+// of tuples about to be loaded), keeping each sampled tuple's
+// attribute hashes; it measures each attribute's entropy (how many
+// bits' worth of distinct values it has) and the balance of its
+// hash bits, then builds a choice vector one bit at a time: each
+// bit is the next unused hash bit of whichever attribute, added to
+// the bits chosen so far, leaves the smallest largest bucket in the
+// sample (ties go to the most even spread, by entropy); once there
+// are too few sampled tuples per bucket to tell, each further bit
+// goes to the attribute with the most entropy not yet used up
+//
+// The tuples per bucket (and so the overflow chain lengths) that the
+// current and proposed choice vectors would give are predicted for
+// the relation's size, by placing the sample in its buckets
+//
+// rebuildRelation() copies a relation into a new one with another
+// choice vector (and the same creation options), which then replaces
+// it; the relation can be read (but not changed) while it is copied
+
+#define DSAMPLE    100000  // default sample size (tuples)
+#define MINPER     8       // sampled tuples per bucket to choose a bit by trial
+#define MAXTRIAL   24      // most bits chosen by trial (2^MAXTRIAL counters)
+#define SKEWLIMIT  0.1     // a hash bit is skewed if its share of 1s
+                           // is further than this from 0.5
+#define SHOWBITS   8       // low hash bits whose balance is shown
+#define COPYBATCH  1024    // tuples copied at a time by rebuildRelation()
+
+typedef struct {
+	Reln     rel;
+	Count    nattrs;
+	Count    max;          // sample size wanted
+	Count    size;         // tuples in the sample
+	uint64_t seen;         // tuples sampled from
+	uint64_t bytes;        // their total length
+	Bits     *h;           // attribute hashes: h[i*nattrs + a]
+	uint64_t rand;         // xorshift state
+} Sample;
+
+typedef struct {
+	uint64_t ntups;        // tuples in the relation
+	RelnSnapshot shape;    // its buckets
+	Count    perPage;      // estimated tuples per page
+	uint64_t maxTups;      // in the fullest bucket
+	double   maxChain;     // overflow pages of the fullest bucket
+	double   meanChain;
+	PageID   nChained;     // buckets with overflow pages
+	PageID   nEmpty;       // buckets with no tuples
+} Prediction;
+
+static Status parseAdviseOpts(char *opts, Count *max, char *input);
+static void addToSample(Sample *s, char *t);
+static void sampleRelation(Sample *s);
+static Status sampleInput(Sample *s, char *path);
+static double entropy(uint64_t *counts, uint64_t n, uint64_t total, uint64_t *max);
+static double attrEntropy(Sample *s, Count a, uint64_t *distinct);
+static void proposeChVec(Sample *s, double *ent, ChVecItem *cv);
+static void predict(Sample *s, ChVecItem *cv, Prediction *p);
+static void chvecString(ChVecItem *cv, char *buf);
+
+
+// sample relation r (or the tuples to go into it) and propose a
+// choice vector for it, written into cv (CHVECLEN bytes) in the form
+// taken by newRelation(); a report goes to out
+// opts is a comma-separated list of key=value settings
+//   sample=N      sample size in tuples (default: 100000)
+//   input=PATH    sample the tuples in file PATH, one per line
+//                 (e.g. data to be loaded), not the relation
+// returns ~OK (after saying why) if the options are invalid, or
+// there is nothing to sample
+
+Status adviseChVec(Reln r, char *opts, char *cv, FILE *out)
+{
+	char     input[MAXERRMSG] = "";
+	Sample   s;
+	ChVecItem *cur = chvec(r);
+	ChVecItem prop[MAXCHVEC];
+
+	if (parseAdviseOpts(opts, &s.max, input) != OK) return ~OK;
+	s.rel = r;
+	s.nattrs = nattrs(r);
+	s.size = 0;
+	s.seen = s.bytes = 0;
+	s.rand = 0x9e3779b97f4a7c15ULL;
+	s.h = malloc((size_t)s.max * s.nattrs * sizeof(Bits));
+	assert(s.h != NULL);
+	if (input[0] != '\0') {
+		if (sampleInput(&s, input) != OK) { free(s.h); return ~OK; }
+	}
+	else
+		sampleRelation(&s);
+	if (s.size == 0) {
+		printf("Nothing to sample\n");
+		free(s.h);
+		return ~OK;
+	}
+
+	fprintf(out, "Sample: %d of %"PRIu64" tuples (%s)\n", s.size, s.seen,
+	        input[0] != '\0' ? input : "relation");
+	fprintf(out, "%-5s %9s %8s  %s\n", "Attr", "Distinct", "Entropy",
+	        "Share of 1s in hash bits 0..7");
+	double ent[s.nattrs];
+	for (Count a = 0; a < s.nattrs; a++) {
+		uint64_t distinct;
+		ent[a] = attrEntropy(&s, a, &distinct);
+		fprintf(out, "%-5d %9"PRIu64" %8.2f ", a, distinct, ent[a]);
+		for (Count b = 0; b < SHOWBITS; b++) {
+			uint64_t ones = 0;
+			for (Count i = 0; i < s.size; i++)
+				ones += (s.h[(size_t)i * s.nattrs + a] >> b) & 1;
+			fprintf(out, " %.2f", (double)ones / s.size);
+		}
+		putc('\n', out);
+	}
+
+	proposeChVec(&s, ent, prop);
+	chvecString(prop, cv);
+
+	Prediction pc, pp;
+	predict(&s, cur, &pc);
+	predict(&s, prop, &pp);
+	fprintf(out, "Proposed choice vector: %s\n", cv);
+	fprintf(out, "Predicted for %"PRIu64" tuples in %"PRIu64" buckets (~%d tuples per page):\n",
+	        pc.ntups, pc.shape.npages, pc.perPage);
+	fprintf(out, "%-9s %12s %10s %11s %11s %9s\n", "ChVec", "max tuples",
+	        "max chain", "mean chain", "overflowing", "empty");
+	Prediction *ps[2] = { &pc, &pp };
+	char *names[2] = { "current", "proposed" };
+	for (int k = 0; k < 2; k++)
+		fprintf(out, "%-9s %12"PRIu64" %10.1f %11.2f %11"PRIu64" %9"PRIu64"\n", names[k],
+		        ps[k]->maxTups, ps[k]->maxChain, ps[k]->meanChain,
+		        ps[k]->nChained, ps[k]->nEmpty);
+
+	free(s.h);
+	return OK;
+}
+
+// replace relation r (opened as name) by a copy of it with choice
+// vector cv: its tuples are copied into a new relation, name.new,
+// with r's creation options, and its files are then renamed over r's
+// r must not be changed while this runs (it can be read), and must
+// be closed afterwards, and the relation reopened
+// returns ~OK (after saying why) if cv is invalid, or the new relation
+// can't be made; r is then unchanged
+
+Status rebuildRelation(Reln r, char *name, char *cv)
+{
+	char    tmp[MAXRELNAME], opts[MAXRELOPTS];
+	char    from[MAXFILENAME], to[MAXFILENAME];
+	char    *exts[3] = { "data", "ovflow", "info" };
+
+	if (strlen(name) + strlen(".new") >= MAXRELNAME) {
+		printf("Relation name too long to rebuild: %s\n", name);
+		return ~OK;
+	}
+	sprintf(tmp, "%s.new", name);
+	relnCreateOpts(r, opts);
+	char cvcopy[strlen(cv) + 1];
+	strcpy(cvcopy, cv);
+	if (newRelationOpts(tmp, nattrs(r), 1, 0, cvcopy, opts) != OK) return ~OK;
+
+	Reln new = openRelation(tmp, "r+");
+	assert(new != NULL);
+	char q[2 * nattrs(r)];
+	for (Count i = 0; i < nattrs(r); i++) { q[2*i] = '?'; q[2*i+1] = ','; }
+	q[2 * nattrs(r) - 1] = '\0';
+	Selection s = startSelectionOpts(r, q, "plan=scan");
+	TupleBatch *b = newTupleBatch(COPYBATCH);
+	while (getNextBatch(s, b) > 0)
+		addTuplesToRelation(new, b->tuples, b->ntuples);
+	freeTupleBatch(b);
+	closeSelection(s);
+	closeRelation(new);
+
+	// the info file goes last: until then, the old one describes
+	// the old data (mostly)
+	for (int i = 0; i < 3; i++) {
+		sprintf(from, "%s.%s", tmp, exts[i]);
+		sprintf(to, "%s.%s", name, exts[i]);
+		if (rename(from, to) != 0) fatal("Can't replace relation files");
+	}
+	return OK;
+}
+
+
+
+// parse the options string given to adviseChVec()
+
+static Status parseAdviseOpts(char *opts, Count *max, char *input)
+{
+	char    buf[MAXERRMSG];
+	char    *c, *key, *val, *save;
+
+	*max = DSAMPLE;
+	if (opts == NULL) return OK;
+	if (strlen(opts) >= MAXERRMSG) {
+		printf("Advice options too long\n");
+		return ~OK;
+	}
+	strcpy(buf, opts);
+	for (c = strtok_r(buf, ",", &save); c != NULL; c = strtok_r(NULL, ",", &save)) {
+		key = c;
+		val = strchr(c, '=');
+		if (val == NULL) {
+			printf("Invalid advice option: %s\n", c);
+			return ~OK;
+		}
+		*val++ = '\0';
+		if (strcmp(key, "sample") == 0) {
+			char *end;
+			long n = strtol(val, &end, 10);
+			if (end == val || *end != '\0' || n < 1 || n > 100000000) {
+				printf("Invalid sample size: %s\n", val);
+				return ~OK;
+			}
+			*max = n;
+		}
+		else if (strcmp(key, "input") == 0)
+			strcpy(input, val);
+		else {
+			printf("Unknown advice option: %s\n", key);
+			return ~OK;
+		}
+	}
+	return OK;
+}
+
+// offer tuple t to the sample (reservoir sampling: each of the
+// tuples offered so far is in the sample with equal chance)
+
+static void addToSample(Sample *s, char *t)
+{
+	Count i;
+	Count len = strlen(t);
+
+	s->seen++;
+	s->bytes += len;
+	if (s->size < s->max)
+		i = s->size++;
+	else {
+		s->rand ^= s->rand << 13;
+		s->rand ^= s->rand >> 7;
+		s->rand ^= s->rand << 17;
+		uint64_t j = s->rand % s->seen;
+		if (j >= s->max) return;
+		i = j;
+	}
+
+	char buf[MAXTUPLEN];
+	char *vals[s->nattrs];
+	strcpy(buf, t);
+	Count n = splitTuple(buf, vals, s->nattrs);
+	for (Count a = 0; a < s->nattrs; a++) {
+		char *v = (a < n) ? vals[a] : "";
+		s->h[(size_t)i * s->nattrs + a] = attrHash(s->rel, a, v, strlen(v));
+	}
+}
+
+// sample the relation's tuples, in one sequential scan
+
+static void sampleRelation(Sample *s)
+{
+	Count n = s->nattrs;
+	char q[2 * n];
+	for (Count i = 0; i < n; i++) { q[2*i] = '?'; q[2*i+1] = ','; }
+	q[2 * n - 1] = '\0';
+
+	Selection sel = startSelectionOpts(s->rel, q, "plan=scan");
+	TupleBatch *b = newTupleBatch(COPYBATCH);
+	while (getNextBatch(sel, b) > 0) {
+		for (Count i = 0; i < b->ntuples; i++)
+			addToSample(s, b->tuples[i]);
+	}
+	freeTupleBatch(b);
+	closeSelection(sel);
+}
+
+// sample the tuples in a file, one per line
+// (lines that aren't tuples of the relation are skipped)
+
+static Status sampleInput(Sample *s, char *path)
+{
+	char line[MAXTUPLEN + 2];
+	FILE *in = fopen(path, "r");
+	if (in == NULL) {
+		printf("Can't open %s\n", path);
+		return ~OK;
+	}
+	while (fgets(line, sizeof(line), in) != NULL) {
+		Count len = strlen(line);
+		if (len > 0 && line[len-1] == '\n') line[--len] = '\0';
+		if (tupleFits(s->rel, line)) addToSample(s, line);
+	}
+	fclose(in);
+	return OK;
+}
+
+// the entropy (in bits) of a distribution of total things over
+// n counters; *max is set to the biggest count
+
+static double entropy(uint64_t *counts, uint64_t n, uint64_t total, uint64_t *max)
+{
+	double  h = 0.0;
+	*max = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		if (counts[i] == 0) continue;
+		double p = (double)counts[i] / total;
+		h -= p * log2(p);
+		if (counts[i] > *max) *max = counts[i];
+	}
+	return h;
+}
+
+static int cmpBits(const void *a, const void *b)
+{
+	Bits x = *(Bits *)a, y = *(Bits *)b;
+	return (x > y) - (x < y);
+}
+
+// the entropy of attribute a's values in the sample (from their
+// hashes), and the number of distinct values
+
+static double attrEntropy(Sample *s, Count a, uint64_t *distinct)
+{
+	Bits *v = malloc(s->size * sizeof(Bits));
+	assert(v != NULL);
+	for (Count i = 0; i < s->size; i++) v[i] = s->h[(size_t)i * s->nattrs + a];
+	qsort(v, s->size, sizeof(Bits), cmpBits);
+
+	double  h = 0.0;
+	*distinct = 0;
+	for (Count i = 0, j; i < s->size; i = j) {
+		for (j = i + 1; j < s->size && v[j] == v[i]; j++) ;
+		double p = (double)(j - i) / s->size;
+		h -= p * log2(p);
+		(*distinct)++;
+	}
+	free(v);
+	return h;
+}
+
+// choose a choice vector for the sample (see the top of this file);
+// ent[a] is the entropy of attribute a
+
+static void proposeChVec(Sample *s, double *ent, ChVecItem *cv)
+{
+	Count   n = s->nattrs;
+	Count   next[n];        // next unused hash bit of each attribute
+	double  left[n];        // entropy not yet used
+	Bits    *keys = calloc(s->size, sizeof(Bits));
+	Count   ntrial = 0;
+	assert(keys != NULL);
+
+	for (Count a = 0; a < n; a++) { next[a] = 0; left[a] = ent[a]; }
+	while (ntrial < MAXTRIAL && ((uint64_t)MINPER << (ntrial + 1)) <= s->size)
+		ntrial++;
+	uint64_t *counts = malloc(((size_t)1 << ntrial) * sizeof(uint64_t));
+	assert(counts != NULL);
+
+	for (Count i = 0; i < MAXCHVEC; i++) {
+		Count   best = n;
+		if (i < ntrial) {
+			uint64_t bestMax = 0;
+			double  bestH = 0.0;
+			size_t  nk = (size_t)2 << i;
+			for (Count a = 0; a < n; a++) {
+				if (next[a] >= MAXBITS) continue;
+				memset(counts, 0, nk * sizeof(uint64_t));
+				for (Count t = 0; t < s->size; t++) {
+					Bits bit = (s->h[(size_t)t * n + a] >> next[a]) & 1;
+					counts[keys[t] | (bit << i)]++;
+				}
+				uint64_t max;
+				double h = entropy(counts, nk, s->size, &max);
+				if (best == n || max < bestMax || (max == bestMax && h > bestH)) {
+					best = a;
+					bestMax = max;
+					bestH = h;
+				}
+			}
+		}
+		else {
+			for (Count a = 0; a < n; a++) {
+				if (next[a] >= MAXBITS) continue;
+				if (best == n || left[a] > left[best]) best = a;
+			}
+		}
+		assert(best < n);
+		cv[i].att = best;
+		cv[i].bit = next[best]++;
+		left[best] -= 1.0;
+		if (i < ntrial) {
+			for (Count t = 0; t < s->size; t++)
+				keys[t] |= ((s->h[(size_t)t * n + best] >> cv[i].bit) & 1) << i;
+		}
+	}
+	free(counts);
+	free(keys);
+}
+
+// predict how the relation's tuples would be spread over its
+// buckets with choice vector cv (see the top of this file)
+
+static void predict(Sample *s, ChVecItem *cv, Prediction *p)
+{
+	// the relation's size, and its shape at that size
+	p->ntups = (s->seen > ntuples(s->rel)) ? s->seen : ntuples(s->rel);
+	relnShapeFor(s->rel, p->ntups, &p->shape);
+	double  avg = (double)s->bytes / s->seen;
+	p->perPage = (PAGESIZE - PAGEHDRSIZE) / (avg + 1);
+	if (p->perPage == 0) p->perPage = 1;
+
+	PageID  nb = p->shape.npages;
+	Count   d = p->shape.depth;
+	Count   *counts = calloc(nb, sizeof(Count));
+	assert(counts != NULL);
+	for (Count t = 0; t < s->size; t++) {
+		Bits h = 0;
+		for (Count i = 0; i <= d && i < MAXCHVEC; i++)
+			h |= ((s->h[(size_t)t * s->nattrs + cv[i].att] >> cv[i].bit) & 1) << i;
+		PageID b = 0;    // the only bucket, at depth 0
+		if (d > 0) {
+			b = getLower(h, d);
+			if (b < p->shape.sp) b = getLower(h, d + 1);
+		}
+		counts[b]++;
+	}
+
+	double  scale = (double)p->ntups / s->size;
+	double  chains = 0.0;
+	Count   maxCount = 0;
+	p->nChained = p->nEmpty = 0;
+	for (PageID b = 0; b < nb; b++) {
+		double tups = counts[b] * scale;
+		double pages = ceil(tups / p->perPage);
+		if (counts[b] == 0) p->nEmpty++;
+		if (pages > 1) { chains += pages - 1; p->nChained++; }
+		if (counts[b] > maxCount) maxCount = counts[b];
+	}
+	p->maxTups = (uint64_t)(maxCount * scale + 0.5);
+	p->maxChain = ceil((double)p->maxTups / p->perPage);
+	p->maxChain = (p->maxChain > 1) ? p->maxChain - 1 : 0;
+	p->meanChain = chains / nb;
+	free(counts);
+}
+
+// a choice vector, in the form taken by parseChVec()
+
+static void chvecString(ChVecItem *cv, char *buf)
+{
+	char *c = buf;
+	for (Count i = 0; i < MAXCHVEC; i++)
+		c += sprintf(c, "%s%d,%d", i == 0 ? "" : ":", cv[i].att, cv[i].bit);
+}
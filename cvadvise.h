@@ -0,0 +1,17 @@
+// cvadvise.h ... interface to choice vector advice and rebuilds
+// part of Multi-attribute Linear-hashed Files
+// See cvadvise.c for how a choice vector is chosen
+
+#ifndef CVADVISE_H
+#define CVADVISE_H 1
+
+#include "defs.h"
+#include "reln.h"
+#include "chvec.h"
+
+#define CHVECLEN  (MAXCHVEC*8)   // longest choice vector string
+
+Status adviseChVec(Reln r, char *opts, char *cv, FILE *out);
+Status rebuildRelation(Reln r, char *name, char *cv);
+
+#endif
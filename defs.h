@@ -10,15 +10,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include "util.h"
 
 #define PAGESIZE    1024
-#define NO_PAGE     0xffffffff
+#define NO_PAGE     0xffffffffffffffffULL
 #define MAXERRMSG   200
 #define MAXTUPLEN   200
+#define MAXATTRS    (MAXTUPLEN/2)
 #define MAXRELNAME  200
 #define MAXFILENAME MAXRELNAME+8
-#define MAXBITS     32
+#define MAXBITS     64
 #define OK          0
 #define TRUE        1
 #define FALSE       0
@@ -28,6 +31,6 @@ typedef unsigned char Byte;
 typedef int Status;
 typedef unsigned int Offset;
 typedef unsigned int Count;
-typedef Offset PageID;
+typedef uint64_t PageID;   // 64-bit, so data files can exceed 4GB
 
 #endif
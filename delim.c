@@ -0,0 +1,174 @@
+// delim.c ... bulk scanning for tuple delimiters
+// part of Multi-attribute Linear-hashed Files
+// Finding the '\0's that end tuples and the ','s between values
+
+#include "defs.h"
+#include "delim.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+// Rather than looking at one byte at a time, findDelims() compares
+// a whole block of bytes with '\0' and ',' at once (16 bytes with
+// SSE2, 32 with AVX2), and turns each comparison into bits of a
+// bitmap with a bit per byte; callers then step from delimiter to
+// delimiter with nextDelim(), which skips 64 bytes per word
+//
+// The kernel is picked on first use from what the CPU supports
+// (AVX2, else SSE2 on x86-64, else plain C); useDelimKernel() can
+// choose another one, e.g. to compare them
+//
+// Blocks never extend past the n bytes asked for; any bytes left
+// over at the end are done one at a time
+
+typedef void (*Kernel)(char *s, Count n, Bits *nuls, Bits *commas);
+
+static void scanScalar(char *s, Count n, Bits *nuls, Bits *commas);
+#ifdef HAVE_X86
+static void scanSSE2(char *s, Count n, Bits *nuls, Bits *commas);
+static void scanAVX2(char *s, Count n, Bits *nuls, Bits *commas);
+#endif
+
+static struct {
+	char   *name;
+	Kernel  fn;
+} kernels[] = {
+	{ "scalar", scanScalar },
+#ifdef HAVE_X86
+	{ "sse2", scanSSE2 },
+	{ "avx2", scanAVX2 },
+#endif
+};
+#define NKERNELS (sizeof(kernels)/sizeof(kernels[0]))
+
+static int kernel = -1;   // index in kernels[] (-1 = not picked yet)
+
+static void pickKernel(void);
+static Bool supported(int k);
+
+
+// set bit i of nuls (commas) for each '\0' (',') in s[0..n-1]
+// nuls and commas have DELIMWORDS(n) words; either may be NULL
+
+void findDelims(char *s, Count n, Bits *nuls, Bits *commas)
+{
+	if (kernel < 0) pickKernel();
+	Count nw = DELIMWORDS(n);
+	if (nuls != NULL) memset(nuls, 0, nw * sizeof(Bits));
+	if (commas != NULL) memset(commas, 0, nw * sizeof(Bits));
+	kernels[kernel].fn(s, n, nuls, commas);
+}
+
+// positions of the first max ','s in s[0..n-1], in pos[]
+// returns how many there are (at most max)
+
+Count findCommas(char *s, Count n, Count *pos, Count max)
+{
+	Bits commas[DELIMWORDS(MAXTUPLEN)];
+	Count k = 0;
+
+	for (Count base = 0; base < n && k < max; base += MAXTUPLEN) {
+		Count len = (n - base < MAXTUPLEN) ? n - base : MAXTUPLEN;
+		Count nw = DELIMWORDS(len);
+		findDelims(s + base, len, NULL, commas);
+		for (Count w = 0; w < nw && k < max; w++) {
+			for (Bits b = commas[w]; b != 0 && k < max; b &= b - 1)
+				pos[k++] = base + w * 64 + __builtin_ctzll(b);
+		}
+	}
+	return k;
+}
+
+// use the named kernel ("scalar", "sse2" or "avx2")
+// returns ~OK if there is no such kernel on this CPU
+
+Status useDelimKernel(char *name)
+{
+	for (int k = 0; k < NKERNELS; k++) {
+		if (strcmp(kernels[k].name, name) == 0 && supported(k)) {
+			kernel = k;
+			return OK;
+		}
+	}
+	return ~OK;
+}
+
+char *delimKernelName(void)
+{
+	if (kernel < 0) pickKernel();
+	return kernels[kernel].name;
+}
+
+
+
+// choose the widest kernel this CPU can run
+
+static void pickKernel(void)
+{
+	int k = NKERNELS - 1;
+	while (!supported(k)) k--;
+	kernel = k;
+}
+
+static Bool supported(int k)
+{
+#ifdef HAVE_X86
+	if (strcmp(kernels[k].name, "avx2") == 0) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+	}
+#endif
+	return TRUE;
+}
+
+// the bytes from i on, one at a time
+
+static inline void scanTail(char *s, Count i, Count n, Bits *nuls, Bits *commas)
+{
+	for (; i < n; i++) {
+		if (s[i] == '\0' && nuls != NULL) nuls[i/64] |= (Bits)1 << (i%64);
+		if (s[i] == ',' && commas != NULL) commas[i/64] |= (Bits)1 << (i%64);
+	}
+}
+
+static void scanScalar(char *s, Count n, Bits *nuls, Bits *commas)
+{
+	scanTail(s, 0, n, nuls, commas);
+}
+
+#ifdef HAVE_X86
+
+static void scanSSE2(char *s, Count n, Bits *nuls, Bits *commas)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i comma = _mm_set1_epi8(',');
+	Count i;
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i b = _mm_loadu_si128((__m128i *)(s + i));
+		if (nuls != NULL)
+			nuls[i/64] |= (Bits)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(b, zero)) << (i%64);
+		if (commas != NULL)
+			commas[i/64] |= (Bits)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(b, comma)) << (i%64);
+	}
+	scanTail(s, i, n, nuls, commas);
+}
+
+__attribute__((target("avx2")))
+static void scanAVX2(char *s, Count n, Bits *nuls, Bits *commas)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i comma = _mm256_set1_epi8(',');
+	Count i;
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i b = _mm256_loadu_si256((__m256i *)(s + i));
+		if (nuls != NULL)
+			nuls[i/64] |= (Bits)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, zero)) << (i%64);
+		if (commas != NULL)
+			commas[i/64] |= (Bits)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, comma)) << (i%64);
+	}
+	scanTail(s, i, n, nuls, commas);
+}
+
+#endif
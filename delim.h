@@ -0,0 +1,34 @@
+// delim.h ... interface to bulk delimiter scanning
+// part of Multi-attribute Linear-hashed Files
+// See delim.c for details of the scanning kernels
+
+#ifndef DELIM_H
+#define DELIM_H 1
+
+#include "defs.h"
+#include "bits.h"
+
+// #bitmap words for n bytes (a bit per byte)
+#define DELIMWORDS(n)  (((n) + 63) / 64)
+
+void findDelims(char *s, Count n, Bits *nuls, Bits *commas);
+Count findCommas(char *s, Count n, Count *pos, Count max);
+Status useDelimKernel(char *name);
+char *delimKernelName(void);
+
+// position of the first set bit at or after from in an nw-word
+// bitmap from findDelims(); nw*64 if there is none
+
+static inline Count nextDelim(Bits *m, Count nw, Count from)
+{
+	Count w = from / 64;
+	if (w >= nw) return nw * 64;
+	Bits b = m[w] & (~(Bits)0 << (from % 64));
+	while (b == 0) {
+		if (++w == nw) return nw * 64;
+		b = m[w];
+	}
+	return w * 64 + __builtin_ctzll(b);
+}
+
+#endif
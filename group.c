@@ -0,0 +1,342 @@
+// group.c ... GROUP BY and aggregation over a Selection
+// part of Multi-attribute Linear-hashed Files
+// Manage creating and using Grouping objects
+
+#include "defs.h"
+#include "group.h"
+#include "select.h"
+#include "project.h"
+#include "reln.h"
+#include "tuple.h"
+#include "chvec.h"
+#include "hash.h"
+
+// A Grouping runs a query (as for startSelection) and groups the
+// matching tuples on some attributes, giving one row per group:
+//   "g1,...,gk,agg1,...,aggm"
+// The aggregates are count, and sum/min/max of an attribute;
+// sum/min/max only use values that look like numbers, and are
+// empty for a group with no such values
+//
+// Groups are kept in an open-addressing hash table (linear probing);
+// groups and their keys are allocated from an arena (see arena.c),
+// which is released in one go
+//
+// If every hash bit the relation uses to choose a bucket comes from
+// a group-by attribute, tuples of one group are all in one bucket;
+// then the Grouping is "partitioned": each bucket's groups are
+// output as soon as the scan leaves the bucket, and the table only
+// ever holds one bucket's groups
+
+#define MINSLOTS   64           // initial table size (power of 2)
+#define ARENACHUNK (64*1024)    // arena grows by this much at a time
+
+// aggregate functions
+#define AGG_COUNT  0
+#define AGG_SUM    1
+#define AGG_MIN    2
+#define AGG_MAX    3
+#define NAGGFNS    4
+
+static char *aggNames[NAGGFNS] = { "count", "sum", "min", "max" };
+
+typedef struct {
+	double   v;   // sum/min/max so far
+	uint64_t n;   // #numeric values seen
+} AggVal;
+
+typedef struct Group {
+	Bits     hash;
+	Count    klen;
+	char    *key;      // group-by values "g1,...,gk"
+	uint64_t count;
+	AggVal   agg[];    // one per aggregate
+} Group;
+
+struct GroupingRep {
+	Reln       rel;
+	Selection  sel;
+	Projection proj;        // group-by attributes, then aggregated ones
+	Count      nby;         // #group-by attributes
+	Count      nagg;        // #aggregates
+	Byte       fn[MAXAGGS]; // aggregate function
+	Count      col[MAXAGGS];// its value's position in a projected row (sum/min/max)
+	Count      ncols;       // #attributes in a projected row
+	Bool       partitioned;
+	Group    **slots;       // hash table
+	Count      nslots;
+	Count      ngroups;
+	Arena      arena;
+	Count      out;         // next slot to output
+	Bool       done;        // no more tuples from sel
+	Bool       pending;     // buf holds the first tuple of the next bucket
+	PageID     bid;         // bucket whose groups are in the table
+	char       buf[MAXTUPLEN];
+};
+
+static Status parseAggs(Grouping g, char *aggs, Count *cols);
+static Bool partitionedBy(Reln r, Selection s, Count nby, Count *by);
+static void clearGroups(Grouping g);
+static Group *findGroup(Grouping g, char *key, Count klen);
+static void addTuple(Grouping g, char *t);
+static void fillGroups(Grouping g);
+static void showGroup(Grouping g, Group *e, char *buf);
+
+
+// set up a Grouping
+// q is a query string, as for startSelection()
+// by is a list of 1-based group-by attributes, e.g. "2" or "1,3"
+// aggs is a list of aggregates, e.g. "count,sum:3,min:3,max:3"
+// returns NULL (after saying why) if by or aggs is invalid
+
+Grouping startGrouping(Reln r, char *q, char *by, char *aggs)
+{
+	Grouping new = malloc(sizeof(struct GroupingRep));
+	assert(new != NULL);
+	new->rel = r;
+
+	// group-by attributes (each once) start the projection
+	Count cols[MAXATTRS + MAXAGGS];
+	new->nby = 0;
+	for (char *c = by; ; c++) {
+		char *end;
+		long a = strtol(c, &end, 10);
+		Bool again = FALSE;
+		for (Count i = 0; i < new->nby; i++) again |= (cols[i] == a - 1);
+		if (end == c || a < 1 || a > nattrs(r) || (*end != ',' && *end != '\0')
+		    || again || new->nby == MAXATTRS) {
+			printf("Invalid group-by attribute: %s\n", c);
+			free(new);
+			return NULL;
+		}
+		cols[new->nby++] = a - 1;
+		c = end;
+		if (*c == '\0') break;
+	}
+
+	// aggregates add any other attributes they are taken over
+	if (parseAggs(new, aggs, cols) != OK) { free(new); return NULL; }
+
+	char attrs[(MAXATTRS + MAXAGGS) * 12];
+	char *c = attrs;
+	for (Count i = 0; i < new->ncols; i++)
+		c += sprintf(c, "%s%d", i > 0 ? "," : "", cols[i] + 1);
+	new->proj = startProjection(r, attrs);
+	assert(new->proj != NULL);
+	new->sel = startSelection(r, q);
+	new->partitioned = partitionedBy(r, new->sel, new->nby, cols);
+
+	new->arena = newArena(ARENACHUNK);
+	new->nslots = MINSLOTS;
+	new->slots = calloc(new->nslots, sizeof(Group *));
+	assert(new->slots != NULL);
+	new->ngroups = 0;
+	new->out = new->nslots;
+	new->done = FALSE;
+	new->pending = FALSE;
+	return new;
+}
+
+// parse the aggregates list; the attributes that sum/min/max
+// are taken over are added to the projected attributes cols[]
+// (g->nby of them so far), unless they are there already
+
+static Status parseAggs(Grouping g, char *aggs, Count *cols)
+{
+	char buf[MAXERRMSG];
+	char *save;
+	g->ncols = g->nby;
+	if (strlen(aggs) >= MAXERRMSG) { printf("Too many aggregates\n"); return ~OK; }
+	strcpy(buf, aggs);
+	g->nagg = 0;
+	for (char *c = strtok_r(buf, ",", &save); c != NULL; c = strtok_r(NULL, ",", &save)) {
+		if (g->nagg == MAXAGGS) { printf("Too many aggregates\n"); return ~OK; }
+		char *arg = strchr(c, ':');
+		if (arg != NULL) *arg++ = '\0';
+		int fn;
+		for (fn = 0; fn < NAGGFNS; fn++) if (strcmp(c, aggNames[fn]) == 0) break;
+		if (fn == NAGGFNS || (fn == AGG_COUNT) != (arg == NULL)) {
+			printf("Invalid aggregate: %s\n", c);
+			return ~OK;
+		}
+		g->fn[g->nagg] = fn;
+		if (fn != AGG_COUNT) {
+			char *end;
+			long a = strtol(arg, &end, 10);
+			if (end == arg || *end != '\0' || a < 1 || a > nattrs(g->rel)) {
+				printf("Invalid aggregate attribute: %s\n", arg);
+				return ~OK;
+			}
+			Count k = 0;
+			while (k < g->ncols && cols[k] != a - 1) k++;
+			if (k == g->ncols) cols[g->ncols++] = a - 1;
+			g->col[g->nagg] = k;
+		}
+		g->nagg++;
+	}
+	return OK;
+}
+
+// are all hash bits that choose a bucket from group-by attributes?
+// (and does the scan go bucket by bucket? see choosePlan() in select.c)
+
+static Bool partitionedBy(Reln r, Selection s, Count nby, Count *by)
+{
+	return selectionByBucket(s) && bucketChosenBy(r, selectionSnapshot(s), nby, by);
+}
+
+// empty the table and arena (the first arena chunk is kept)
+
+static void clearGroups(Grouping g)
+{
+	memset(g->slots, 0, g->nslots * sizeof(Group *));
+	g->ngroups = 0;
+	g->out = 0;
+	arenaReset(g->arena);
+}
+
+// find the group with this key, adding it if it's new
+// the table is doubled when it gets 3/4 full
+
+static Group *findGroup(Grouping g, char *key, Count klen)
+{
+	Bits h = hashValue(HASH_WY, (unsigned char *)key, klen);
+	Count mask = g->nslots - 1;
+	Count i = h & mask;
+	while (g->slots[i] != NULL) {
+		Group *e = g->slots[i];
+		if (e->hash == h && e->klen == klen && memcmp(e->key, key, klen) == 0)
+			return e;
+		i = (i + 1) & mask;
+	}
+
+	Group *e = arenaAlloc(g->arena, sizeof(Group) + g->nagg * sizeof(AggVal));
+	e->key = arenaAlloc(g->arena, klen + 1);
+	memcpy(e->key, key, klen);
+	e->key[klen] = '\0';
+	e->hash = h;
+	e->klen = klen;
+	e->count = 0;
+	for (Count k = 0; k < g->nagg; k++) e->agg[k].n = 0;
+	g->slots[i] = e;
+	g->ngroups++;
+
+	if (g->ngroups * 4 > g->nslots * 3) {
+		Count n = g->nslots * 2;
+		Group **slots = calloc(n, sizeof(Group *));
+		assert(slots != NULL);
+		for (Count j = 0; j < g->nslots; j++) {
+			Group *x = g->slots[j];
+			if (x == NULL) continue;
+			Count k = x->hash & (n - 1);
+			while (slots[k] != NULL) k = (k + 1) & (n - 1);
+			slots[k] = x;
+		}
+		free(g->slots);
+		g->slots = slots;
+		g->nslots = n;
+	}
+	return e;
+}
+
+// add a (projected) tuple "g1,...,gk,a1,...,am" to its group
+
+static void addTuple(Grouping g, char *t)
+{
+	// the key is everything before the nby'th comma
+	Count klen = 0, n = 0;
+	for (; t[klen] != '\0'; klen++)
+		if (t[klen] == ',' && ++n == g->nby) break;
+	Group *e = findGroup(g, t, klen);
+	e->count++;
+
+	// (the key has been copied, so t can be split)
+	char *vals[MAXATTRS + MAXAGGS];
+	splitTuple(t, vals, g->ncols);
+	for (Count k = 0; k < g->nagg; k++) {
+		if (g->fn[k] == AGG_COUNT) continue;
+		char *end;
+		double v = strtod(vals[g->col[k]], &end);
+		if (end == vals[g->col[k]] || *end != '\0') continue;
+		AggVal *a = &e->agg[k];
+		if (a->n == 0)
+			a->v = v;
+		else if (g->fn[k] == AGG_SUM)
+			a->v += v;
+		else if (g->fn[k] == AGG_MIN && v < a->v)
+			a->v = v;
+		else if (g->fn[k] == AGG_MAX && v > a->v)
+			a->v = v;
+		a->n++;
+	}
+}
+
+// collect the next lot of groups: all of them, or, if partitioned,
+// those in the next bucket of the scan
+
+static void fillGroups(Grouping g)
+{
+	clearGroups(g);
+	if (g->pending) {
+		addTuple(g, g->buf);
+		g->pending = FALSE;
+	}
+	while (getNextProjected(g->sel, g->proj, g->buf)) {
+		if (g->partitioned) {
+			PageID b = selectionBucket(g->sel);
+			if (g->ngroups > 0 && b != g->bid) {
+				g->bid = b;
+				g->pending = TRUE;
+				return;
+			}
+			g->bid = b;
+		}
+		addTuple(g, g->buf);
+	}
+	g->done = TRUE;
+}
+
+// write a group's result row into buf
+
+static void showGroup(Grouping g, Group *e, char *buf)
+{
+	char *c = buf + sprintf(buf, "%s", e->key);
+	for (Count k = 0; k < g->nagg; k++) {
+		if (g->fn[k] == AGG_COUNT)
+			c += sprintf(c, ",%"PRIu64, e->count);
+		else if (e->agg[k].n == 0)
+			c += sprintf(c, ",");
+		else
+			c += sprintf(c, ",%.15g", e->agg[k].v);
+	}
+}
+
+// get the next group's result row (at most MAXGROUPLEN chars)
+// returns FALSE when there are no more groups
+
+Bool getNextGroup(Grouping g, char *buf)
+{
+	while (TRUE) {
+		while (g->out < g->nslots) {
+			Group *e = g->slots[g->out++];
+			if (e != NULL) {
+				showGroup(g, e, buf);
+				return TRUE;
+			}
+		}
+		if (g->done) return FALSE;
+		fillGroups(g);
+	}
+}
+
+Bool groupingPartitioned(Grouping g) { return g->partitioned; }
+
+void closeGrouping(Grouping g)
+{
+	closeSelection(g->sel);
+	closeProjection(g->proj);
+	countAllocs(g->rel, g->arena);
+	freeArena(g->arena);
+	free(g->slots);
+	free(g);
+}
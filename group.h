@@ -0,0 +1,21 @@
+// group.h ... interface to GROUP BY / aggregation
+// part of Multi-attribute Linear-hashed Files
+// See group.c for details of Grouping type and functions
+
+#ifndef GROUP_H
+#define GROUP_H 1
+
+typedef struct GroupingRep *Grouping;
+
+#include "reln.h"
+#include "tuple.h"
+
+#define MAXAGGS     16
+#define MAXGROUPLEN (MAXTUPLEN + MAXAGGS*32)   // longest result row
+
+Grouping startGrouping(Reln r, char *q, char *by, char *aggs);
+Bool getNextGroup(Grouping g, char *buf);
+Bool groupingPartitioned(Grouping g);
+void closeGrouping(Grouping g);
+
+#endif
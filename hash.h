@@ -1,6 +1,7 @@
 // hash.h ... interface to hash function
 // part of Multi-attribute Linear-hashed Files
-// Hash function from PostgreSQL
+// Hash function from PostgreSQL, plus alternative hash functions
+// that can be selected per relation when it is created
 // Last modified by John Shepherd, July 2019
 
 #ifndef HASH_H
@@ -8,6 +9,15 @@
 
 #include "bits.h"
 
+// hash function families (value is stored in the .info file)
+#define HASH_ANY    0   // PostgreSQL hash_any (default)
+#define HASH_WY     1   // wyhash-style 64-bit hash, word loads
+#define NHASHFNS    2
+
 Bits hash_any(unsigned char *, int);
+Bits hash_wy(unsigned char *, int);
+Bits hashValue(int, unsigned char *, int);
+int hashFnByName(char *);
+char *hashFnName(int);
 
 #endif
@@ -0,0 +1,404 @@
+// join.c ... equi-join of two relations
+// part of Multi-attribute Linear-hashed Files
+// Manage creating and using Join objects
+
+#include "defs.h"
+#include "join.h"
+#include "project.h"
+#include "reln.h"
+#include "tuple.h"
+#include "chvec.h"
+#include "hash.h"
+
+// A Join pairs up the tuples of relations r and s whose join
+// attributes are equal (as strings), giving rows "rtuple,stuple"
+//
+// The tuples are split into partitions, so that joining tuples are
+// always in the same partition; then, one partition at a time, the
+// smaller relation's tuples go into an in-memory hash table (chained,
+// with entries in an arena; see arena.c), and the other's are looked
+// up in it
+//
+// If both relations use the same hash function, and the low m bits
+// of their choice vectors come from the same bits of paired join
+// attributes, joining tuples agree on the low m bits of their
+// hashes; if m is no more than either relation's depth, those are
+// the low m bits of their bucket numbers. Then the join is
+// "partitioned": partition p is the buckets whose number is p modulo
+// 2^m in each relation, read straight from the relations (whatever
+// their depths and split pointers)
+//
+// Otherwise both relations are read once, and each tuple is written
+// to one of nparts temporary files for its relation, chosen by a hash
+// of its join values (a Grace hash join)
+
+#define MINSLOTS    64           // initial table size (power of 2)
+#define ARENACHUNK  (64*1024)    // arena grows by this much at a time
+#define PARTTUPLES  32768        // Grace: aim for this many tuples per partition
+#define MAXPARTS    256
+
+typedef struct Entry {
+	struct Entry *next;   // in hash chain
+	Bits     hash;
+	Count    klen;
+	char    *key;         // join values "v1,...,vk"
+	char    *tup;
+} Entry;
+
+// where a partition's tuples come from: a relation's buckets
+// p, p+step, p+2*step, ... (partitioned) or a temporary file
+typedef struct {
+	Reln     rel;
+	RelnSnapshot snap;
+	PageID   bid;         // next bucket to read
+	PageID   step;
+	FILE    *f;
+	Page    *pages;       // pages of the current bucket
+	Count    npages;
+	Count    ipage;       // page being scanned
+	PageScan scan;
+	char     buf[MAXTUPLEN+1];
+} Source;
+
+struct JoinRep {
+	Reln       rel[2];       // r and s
+	Projection key[2];       // their join attributes
+	RelnSnapshot snap[2];
+	Count      build;        // which relation goes in the table (0 = r)
+	Bool       partitioned;
+	Count      mbits;        // partitioned: #bucket bits that partition
+	FILE     **files[2];     // Grace: each relation's partition files
+	Count      nparts;
+	Count      part;         // next partition
+	Entry    **slots;        // hash table
+	Count      nslots;
+	Count      nentries;
+	Arena      arena;
+	Source     probe;        // tuples being looked up
+	char       ptup[MAXTUPLEN];
+	char       pkey[MAXTUPLEN];
+	Count      pklen;
+	Bits       phash;
+	Entry     *match;        // next entry to check for ptup
+};
+
+static Count sharedBits(Join j);
+static Count joinKey(Join j, Count i, Tuple t, char *key);
+static void partitionAll(Join j, Count i);
+static void openSource(Join j, Source *src, Count i, Count p);
+static Tuple nextFromSource(Source *src);
+static void closeSource(Source *src);
+static void startPartition(Join j, Count p);
+static void clearTable(Join j);
+static void addEntry(Join j, Tuple t);
+
+
+// set up a Join of r and s
+// rattrs and sattrs are lists of 1-based join attributes of each
+// relation, paired in order, e.g. "1" and "2", or "1,3" and "2,1"
+// returns NULL (after saying why) if they are invalid
+
+Join startJoin(Reln r, char *rattrs, Reln s, char *sattrs)
+{
+	Join new = malloc(sizeof(struct JoinRep));
+	assert(new != NULL);
+	new->rel[0] = r;
+	new->rel[1] = s;
+	new->key[0] = startProjection(r, rattrs);
+	new->key[1] = startProjection(s, sattrs);
+	if (new->key[0] == NULL || new->key[1] == NULL
+	    || projectionSize(new->key[0]) != projectionSize(new->key[1])) {
+		printf("Invalid join attributes: %s and %s\n", rattrs, sattrs);
+		if (new->key[0] != NULL) closeProjection(new->key[0]);
+		if (new->key[1] != NULL) closeProjection(new->key[1]);
+		free(new);
+		return NULL;
+	}
+	relnSnapshot(r, &new->snap[0]);
+	relnSnapshot(s, &new->snap[1]);
+	new->build = (ntuples(s) < ntuples(r)) ? 1 : 0;
+
+	new->mbits = sharedBits(new);
+	if (new->mbits > new->snap[0].depth) new->mbits = new->snap[0].depth;
+	if (new->mbits > new->snap[1].depth) new->mbits = new->snap[1].depth;
+	new->partitioned = (new->mbits > 0);
+	new->files[0] = new->files[1] = NULL;
+	if (new->partitioned)
+		new->nparts = (Count)1 << new->mbits;
+	else {
+		uint64_t n = ntuples(new->rel[new->build]);
+		new->nparts = 1;
+		while (new->nparts < MAXPARTS && new->nparts * (uint64_t)PARTTUPLES < n)
+			new->nparts *= 2;
+		partitionAll(new, 0);
+		partitionAll(new, 1);
+	}
+
+	new->nslots = MINSLOTS;
+	new->slots = calloc(new->nslots, sizeof(Entry *));
+	assert(new->slots != NULL);
+	new->nentries = 0;
+	new->arena = newArena(ARENACHUNK);
+	new->part = 0;
+	new->match = NULL;
+	new->probe.pages = NULL;
+	new->probe.npages = new->probe.ipage = 0;
+	new->probe.f = NULL;
+	new->probe.bid = new->probe.step = 0;
+	new->probe.snap.npages = 0;
+	return new;
+}
+
+// how many low bits of r's and s's hashes come from the same
+// bits of paired join attributes, hashed alike (0 if the hash
+// functions differ; see hashesAlike() for typed attributes)
+
+static Count sharedBits(Join j)
+{
+	ChVecItem *rcv = chvec(j->rel[0]), *scv = chvec(j->rel[1]);
+	Count nk = projectionSize(j->key[0]);
+
+	if (hashfn(j->rel[0]) != hashfn(j->rel[1])) return 0;
+	Count i;
+	for (i = 0; i < MAXCHVEC; i++) {
+		if (rcv[i].bit != scv[i].bit) break;
+		Bool paired = FALSE;
+		for (Count k = 0; k < nk && !paired; k++)
+			paired = (projectedAttr(j->key[0], k) == rcv[i].att
+			          && projectedAttr(j->key[1], k) == scv[i].att
+			          && hashesAlike(attrType(j->rel[0], rcv[i].att),
+			                         attrType(j->rel[1], scv[i].att)));
+		if (!paired) break;
+	}
+	return i;
+}
+
+// write the join values of tuple t of relation i into key
+// (t is left alone, unlike with projectTuple()); returns its length
+
+static Count joinKey(Join j, Count i, Tuple t, char *key)
+{
+	char *c = key;
+	for (Count k = 0; k < projectionSize(j->key[i]); k++) {
+		char *v = t;
+		for (Count a = projectedAttr(j->key[i], k); a > 0; a--) {
+			while (*v != ',' && *v != '\0') v++;
+			if (*v == ',') v++;
+		}
+		Count n = strcspn(v, ",");
+		if (k > 0) *c++ = ',';
+		memcpy(c, v, n);
+		c += n;
+	}
+	*c = '\0';
+	return c - key;
+}
+
+// Grace: write each tuple of relation i to its partition's file
+
+static void partitionAll(Join j, Count i)
+{
+	Source src;
+	char key[MAXTUPLEN];
+	Tuple t;
+
+	j->files[i] = malloc(j->nparts * sizeof(FILE *));
+	assert(j->files[i] != NULL);
+	for (Count p = 0; p < j->nparts; p++) {
+		j->files[i][p] = tmpfile();
+		if (j->files[i][p] == NULL) fatal("Can't create join partition file");
+	}
+	src.rel = j->rel[i];
+	src.snap = j->snap[i];
+	src.bid = 0;
+	src.step = 1;
+	src.f = NULL;
+	src.pages = NULL;
+	src.npages = src.ipage = 0;
+	while ((t = nextFromSource(&src)) != NULL) {
+		Count klen = joinKey(j, i, t, key);
+		Bits h = hashValue(HASH_WY, (unsigned char *)key, klen);
+		FILE *f = j->files[i][(h >> 32) & (j->nparts - 1)];
+		fputs(t, f);
+		putc('\n', f);
+	}
+	closeSource(&src);
+	for (Count p = 0; p < j->nparts; p++) rewind(j->files[i][p]);
+}
+
+// start reading partition p of relation i
+
+static void openSource(Join j, Source *src, Count i, Count p)
+{
+	src->rel = j->rel[i];
+	src->snap = j->snap[i];
+	src->pages = NULL;
+	src->npages = src->ipage = 0;
+	if (j->partitioned) {
+		src->f = NULL;
+		src->bid = p;
+		src->step = j->nparts;
+	} else {
+		src->f = j->files[i][p];
+		src->bid = src->step = 0;
+	}
+}
+
+// the next tuple from a partition (NULL at the end)
+// the string belongs to the Source, until the next call
+
+static Tuple nextFromSource(Source *src)
+{
+	if (src->f != NULL) {
+		if (fgets(src->buf, sizeof(src->buf), src->f) == NULL) return NULL;
+		src->buf[strcspn(src->buf, "\n")] = '\0';
+		return src->buf;
+	}
+	while (TRUE) {
+		while (src->ipage < src->npages) {
+			Tuple t = nextPageTuple(src->pages[src->ipage], &src->scan, src->buf);
+			if (t != NULL) return t;
+			free(src->pages[src->ipage]);
+			if (++src->ipage < src->npages)
+				startPageScan(src->pages[src->ipage], &src->scan);
+		}
+		free(src->pages);
+		src->pages = NULL;
+		src->npages = src->ipage = 0;
+		if (src->bid >= src->snap.npages) return NULL;
+		src->npages = readBucket(src->rel, &src->snap, src->bid, &src->pages);
+		src->bid += src->step;
+		startPageScan(src->pages[0], &src->scan);
+	}
+}
+
+static void closeSource(Source *src)
+{
+	for (Count i = src->ipage; i < src->npages; i++) free(src->pages[i]);
+	free(src->pages);
+	src->pages = NULL;
+	src->npages = src->ipage = 0;
+}
+
+// load partition p of the build relation into the table, and
+// start reading the probe relation's partition p
+// (if the table is empty, there is nothing to look up, and the
+// probe partition isn't read at all)
+
+static void startPartition(Join j, Count p)
+{
+	Source src;
+	Tuple t;
+
+	clearTable(j);
+	openSource(j, &src, j->build, p);
+	while ((t = nextFromSource(&src)) != NULL) addEntry(j, t);
+	closeSource(&src);
+
+	closeSource(&j->probe);
+	openSource(j, &j->probe, 1 - j->build, p);
+	if (j->nentries == 0) {
+		j->probe.bid = j->probe.snap.npages;
+		if (j->probe.f != NULL) fseek(j->probe.f, 0, SEEK_END);
+	}
+}
+
+// empty the table and arena (the first arena chunk is kept)
+
+static void clearTable(Join j)
+{
+	memset(j->slots, 0, j->nslots * sizeof(Entry *));
+	j->nentries = 0;
+	arenaReset(j->arena);
+}
+
+// add a build tuple to the table
+// the table is doubled when it has more entries than slots
+
+static void addEntry(Join j, Tuple t)
+{
+	char key[MAXTUPLEN];
+	Count klen = joinKey(j, j->build, t, key), tlen = strlen(t);
+
+	Entry *e = arenaAlloc(j->arena, sizeof(Entry));
+	e->key = arenaAlloc(j->arena, klen + 1 + tlen + 1);
+	memcpy(e->key, key, klen + 1);
+	e->tup = e->key + klen + 1;
+	memcpy(e->tup, t, tlen + 1);
+	e->klen = klen;
+	e->hash = hashValue(HASH_WY, (unsigned char *)key, klen);
+	Count i = e->hash & (j->nslots - 1);
+	e->next = j->slots[i];
+	j->slots[i] = e;
+	j->nentries++;
+
+	if (j->nentries > j->nslots) {
+		Count n = j->nslots * 2;
+		Entry **slots = calloc(n, sizeof(Entry *));
+		assert(slots != NULL);
+		for (Count k = 0; k < j->nslots; k++) {
+			Entry *x = j->slots[k];
+			while (x != NULL) {
+				Entry *next = x->next;
+				Count m = x->hash & (n - 1);
+				x->next = slots[m];
+				slots[m] = x;
+				x = next;
+			}
+		}
+		free(j->slots);
+		j->slots = slots;
+		j->nslots = n;
+	}
+}
+
+// get the next joined row "rtuple,stuple" (at most MAXJOINLEN chars)
+// returns FALSE when there are no more
+
+Bool getNextJoined(Join j, char *buf)
+{
+	while (TRUE) {
+		// remaining entries that might match the probe tuple
+		while (j->match != NULL) {
+			Entry *e = j->match;
+			j->match = e->next;
+			if (e->hash != j->phash || e->klen != j->pklen
+			    || memcmp(e->key, j->pkey, j->pklen) != 0)
+				continue;
+			if (j->build == 0)
+				sprintf(buf, "%s,%s", e->tup, j->ptup);
+			else
+				sprintf(buf, "%s,%s", j->ptup, e->tup);
+			return TRUE;
+		}
+		// next probe tuple
+		Tuple t = nextFromSource(&j->probe);
+		if (t != NULL) {
+			strcpy(j->ptup, t);
+			j->pklen = joinKey(j, 1 - j->build, t, j->pkey);
+			j->phash = hashValue(HASH_WY, (unsigned char *)j->pkey, j->pklen);
+			j->match = j->slots[j->phash & (j->nslots - 1)];
+			continue;
+		}
+		// next partition
+		if (j->part == j->nparts) return FALSE;
+		startPartition(j, j->part++);
+	}
+}
+
+Bool joinPartitioned(Join j) { return j->partitioned; }
+
+void closeJoin(Join j)
+{
+	closeSource(&j->probe);
+	for (Count i = 0; i < 2; i++) {
+		closeProjection(j->key[i]);
+		if (j->files[i] == NULL) continue;
+		for (Count p = 0; p < j->nparts; p++) fclose(j->files[i][p]);
+		free(j->files[i]);
+	}
+	countAllocs(j->rel[j->build], j->arena);
+	freeArena(j->arena);
+	free(j->slots);
+	free(j);
+}
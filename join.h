@@ -0,0 +1,20 @@
+// join.h ... interface to equi-joins of two relations
+// part of Multi-attribute Linear-hashed Files
+// See join.c for details of Join type and functions
+
+#ifndef JOIN_H
+#define JOIN_H 1
+
+typedef struct JoinRep *Join;
+
+#include "reln.h"
+#include "tuple.h"
+
+#define MAXJOINLEN  (2*MAXTUPLEN)   // longest result row
+
+Join startJoin(Reln r, char *rattrs, Reln s, char *sattrs);
+Bool getNextJoined(Join j, char *buf);
+Bool joinPartitioned(Join j);
+void closeJoin(Join j);
+
+#endif
@@ -3,8 +3,31 @@
 // Reading/writing pages into buffers and manipulating contents
 // Last modified by John Shepherd, July 2019
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <math.h>
 #include "defs.h"
 #include "page.h"
+#include "delim.h"
+
+static Status addToPaxPage(Page p, Tuple t);
+static Status addToDictPage(Page p, Tuple t);
+static Status addToTypedPage(Page p, Tuple t, char *text);
+static void zoneAdd(Page p, Tuple t);
+static void sigAdd(Page p, Tuple t);
+
+// #bytes in data[]
+#define DATASIZE (PAGESIZE - PAGEHDRSIZE)
+
+// start of the zone map and n-gram signatures at the end of data[]
+#define zoneStart(p) (DATASIZE - (p)->nzones*2*sizeof(float))
+#define sigStart(p)  (zoneStart(p) - (p)->nsigs*(1 + SIGBYTES))
+#define sigBits(p,i) ((Byte *)(p)->data + sigStart(p) + (p)->nsigs + (i)*SIGBYTES)
+
+// #bytes of data[] for tuples
+#define dataEnd(p) sigStart(p)
 
 /*******************
 EDIT
@@ -16,90 +39,618 @@ EDIT
 
  
 // A Page is a chunk of memory containing PAGESIZE bytes
-// It is implemented as a struct (free, ovflow, data[1])
+// It is implemented as a struct (free, ntuples, ovflow, layout, ncols, data[1])
 // - free is the offset of the first byte of free space
 // - ovflow is the page id of the next overflow page in bucket
 // - data[] is a sequence of bytes containing tuples
-// - each tuple is a sequence of chars terminated by '\0'
+// - in a PAGE_ROW page (the default), each tuple is a sequence
+//   of chars terminated by '\0'
+// - in a PAGE_PAX page, data[] starts with a table of ncols 16-bit
+//   column start offsets, followed by ncols mini-columns; column i
+//   holds attribute i of every tuple, each value terminated by '\0'
+//   (so a tuple takes the same space in either layout)
+// - in a PAGE_DICT page, data[0..free) is a dictionary of distinct
+//   '\0'-terminated values, and the end of data[] holds ncols 1-byte
+//   dictionary codes per tuple, growing down (tuple 0 is last); a
+//   value that repeats within the page is stored once
+// - in a PAGE_TYPED page, data[] starts with the types of the ncols
+//   attributes (see schema.h), and then holds the tuples one after
+//   another, each encoded by encodeTuple(); tuples go in and come out
+//   as text, so the encoding is only seen by code that asks for it
+//   (pageFields())
+// - if nzones > 0, the last nzones*2 floats of data[] are a zone map:
+//   the min and max of the values of each of the first nzones
+//   attributes that look like numbers (min > max if there are none);
+//   the bounds are rounded outwards, so they never exclude a value
+// - if nsigs > 0, the bytes before the zone map hold n-gram
+//   signatures: nsigs attribute numbers (ascending), then for each
+//   of those attributes a SIGBYTES*8-bit set with a bit for each
+//   trigram in its values
+// - an empty page takes on a layout with pageSetLayout() (or
+//   pageSetTypes())
 // - PageID values count # pages from start of file
+// - PageIDs and file offsets are 64-bit; page I/O uses pread/pwrite
+//   on the file's descriptor (stdio buffering is never used for pages)
+
+// allocate an (uninitialised) page buffer
+// buffers are PAGESIZE-aligned, so they can be used for O_DIRECT I/O;
+// they are released with free()
+Page allocPage()
+{
+	void *p = NULL;
+	int ok = posix_memalign(&p, PAGESIZE, PAGESIZE);
+	assert(ok == 0 && p != NULL);
+	return p;
+}
 
 // create a new initially empty page in memory
 Page newPage()
 {
-	Page p = malloc(PAGESIZE);
-	assert(p != NULL);
+	Page p = allocPage();
+	initPage(p);
+	return p;
+}
+
+// make page buffer p an empty page
+void initPage(Page p)
+{
 	p->free = 0;
 	p->ovflow = NO_PAGE;
 	p->ntuples = 0;
-	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
-	int dataSize = PAGESIZE - hdr_size;
-	memset(p->data, 0, dataSize);
-	return p;
+	p->layout = PAGE_ROW;
+	p->ncols = 0;
+	p->nzones = 0;
+	p->nsigs = 0;
+	memset(p->data, 0, PAGESIZE - PAGEHDRSIZE);
 }
 
 // append a new Page to a file; return its PageID
 PageID addPage(FILE *f)
 {
-	int ok = fseek(f, 0, SEEK_END);
-	assert(ok == 0);
-	int pos = ftell(f);
-	assert(pos >= 0);
-	PageID pid = pos/PAGESIZE;
+	PageID pid = filePages(f);
 	Page p = newPage();
-	ok = putPage(f, pid, p);
+	int ok = putPage(f, pid, p);
 	assert(ok == 0);
 	return pid;
 }
 
+// #pages in a file
+PageID filePages(FILE *f)
+{
+	struct stat st;
+	int ok = fstat(fileno(f), &st);
+	assert(ok == 0);
+	return (PageID)st.st_size/PAGESIZE;
+}
+
 // fetch a Page from a file; allocate a memory buffer
 Page getPage(FILE *f, PageID pid)
 {
-	assert(pid >= 0);
-	Page p = malloc(PAGESIZE);
-	assert(p != NULL);
-	int ok = fseek(f, pid*PAGESIZE, SEEK_SET);
-	assert(ok == 0);
-	int n = fread(p, 1, PAGESIZE, f);
-	assert(n == PAGESIZE);
+	Page p = allocPage();
+	readPage(f, pid, p);
 	return p;
 }
 
+// fetch a Page from a file into the caller's buffer
+void readPage(FILE *f, PageID pid, Page p)
+{
+	assert(pid != NO_PAGE);
+	ssize_t n = pread(fileno(f), p, PAGESIZE, (off_t)pid*PAGESIZE);
+	assert(n == PAGESIZE);
+}
+
 // write a Page to a file; release allocated buffer
 Status putPage(FILE *f, PageID pid, Page p)
 {
-	assert(pid >= 0);
-	int ok = fseek(f, pid*PAGESIZE, SEEK_SET);
-	assert(ok == 0);
-	int n = fwrite(p, 1, PAGESIZE, f);
+	assert(pid != NO_PAGE);
+	ssize_t n = pwrite(fileno(f), p, PAGESIZE, (off_t)pid*PAGESIZE);
 	assert(n == PAGESIZE);
 	free(p);
 	return 0;
 }
 
+// hint that a Page will be read soon, so the kernel can
+// start reading it asynchronously; failure is harmless
+void prefetchPage(FILE *f, PageID pid)
+{
+	prefetchPages(f, pid, 1);
+}
+
+// the same for the n pages from pid on
+void prefetchPages(FILE *f, PageID pid, Count n)
+{
+	if (pid == NO_PAGE || n == 0) return;
+	(void)posix_fadvise(fileno(f), (off_t)pid*PAGESIZE, (off_t)n*PAGESIZE,
+	                    POSIX_FADV_WILLNEED);
+}
+
+// PAX column table entries (may be unaligned)
+
+static inline Offset colStart(Page p, Count col)
+{
+	unsigned short off;
+	if (col == p->ncols) return p->free;
+	memcpy(&off, p->data + col*sizeof(off), sizeof(off));
+	return off;
+}
+
+static inline void setColStart(Page p, Count col, Offset start)
+{
+	unsigned short off = start;
+	memcpy(p->data + col*sizeof(off), &off, sizeof(off));
+}
+
 // insert a tuple into a page
 // returns 0 status if successful
 // returns -1 if not enough room
 Status addToPage(Page p, Tuple t)
 {
+	Status ok;
+	char text[MAXTUPLEN];
+	if (p->layout == PAGE_PAX)
+		ok = addToPaxPage(p, t);
+	else if (p->layout == PAGE_DICT)
+		ok = addToDictPage(p, t);
+	else if (p->layout == PAGE_TYPED) {
+		// zone maps and signatures describe the values as they
+		// come back out (e.g. "0.5", not ".5"), which is what
+		// selections compare
+		ok = addToTypedPage(p, t, text);
+		t = text;
+	}
+	else {
+		int n = tupLength(t);
+		char *c = p->data + p->free;
+		// doesn't fit ... return fail code
+		// assume caller will put it elsewhere
+		if (c+n > &p->data[dataEnd(p)-2]) return -1;
+		strcpy(c, t);
+		p->free += n+1;
+		p->ntuples++;
+		ok = OK;
+	}
+	if (ok == OK && p->nzones > 0) zoneAdd(p, t);
+	if (ok == OK && p->nsigs > 0) sigAdd(p, t);
+	return ok;
+}
+
+// insert a tuple into a PAX page
+// each value is appended to the end of its column; columns
+// after it are shifted up (last column first) to make room
+
+static Status addToPaxPage(Page p, Tuple t)
+{
+	Count nc = p->ncols;
 	int n = tupLength(t);
-	char *c = p->data + p->free;
-	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
-	// doesn't fit ... return fail code
-	// assume caller will put it elsewhere
-	if (c+n > &p->data[PAGESIZE-hdr_size-2]) return -1;
-	strcpy(c, t);
+	if (p->free+n > dataEnd(p)-2) return -1;
+
+	// find values in tuple
+	char *val[nc];
+	Count len[nc], before[nc];
+	char *c = t, *c0 = t;
+	Count i, sum = 0;
+	for (i = 0; i < nc; i++) {
+		while (*c != ',' && *c != '\0') c++;
+		val[i] = c0; len[i] = c - c0;
+		before[i] = sum; sum += len[i]+1;
+		if (*c == '\0') break;
+		c++; c0 = c;
+	}
+	// wrong number of attributes
+	if (i != nc-1 || *c != '\0') return -1;
+
+	Offset start[nc+1];
+	for (i = 0; i <= nc; i++) start[i] = colStart(p, i);
+	for (int col = nc-1; col >= 0; col--) {
+		Offset end = start[col+1];
+		memmove(p->data + start[col] + before[col], p->data + start[col], end - start[col]);
+		memcpy(p->data + end + before[col], val[col], len[col]);
+		p->data[end + before[col] + len[col]] = '\0';
+		setColStart(p, col, start[col] + before[col]);
+	}
 	p->free += n+1;
 	p->ntuples++;
 	return OK;
 }
 
+// codes of tuple i in a DICT page
+
+static inline Byte *dictCodes(Page p, Count i)
+{
+	return (Byte *)p->data + dataEnd(p) - (i+1)*p->ncols;
+}
+
+// insert a tuple into a DICT page
+// values not yet in the page's dictionary are appended to it;
+// the tuple costs ncols bytes of codes plus any new values
+
+static Status addToDictPage(Page p, Tuple t)
+{
+	Count nc = p->ncols;
+	Offset dict[MAXDICT];
+	Count ndict = 0, nold;
+	Offset off;
+
+	// index the existing dictionary
+	for (off = 0; off < p->free; off += strlen(p->data + off) + 1)
+		dict[ndict++] = off;
+	nold = ndict;
+
+	// find a code for each value; values not in the dictionary
+	// get new codes (for these, dict[] holds the attribute number)
+	Byte code[nc];
+	char *val[nc];
+	Count len[nc], need = nc;
+	char *c = t, *c0 = t;
+	Count i, k;
+	for (i = 0; i < nc; i++) {
+		while (*c != ',' && *c != '\0') c++;
+		val[i] = c0; len[i] = c - c0;
+		for (k = 0; k < nold; k++) {
+			char *v = p->data + dict[k];
+			if (strncmp(v, c0, len[i]) == 0 && v[len[i]] == '\0') break;
+		}
+		if (k == nold) {
+			for (; k < ndict; k++) {
+				Count a = dict[k];
+				if (len[a] == len[i] && memcmp(val[a], c0, len[i]) == 0) break;
+			}
+		}
+		if (k == ndict) {
+			if (ndict == MAXDICT) return -1;
+			dict[ndict++] = i;
+			need += len[i] + 1;
+		}
+		code[i] = k;
+		if (*c == '\0') break;
+		c++; c0 = c;
+	}
+	// wrong number of attributes
+	if (i != nc-1 || *c != '\0') return -1;
+	// doesn't fit between dictionary and codes
+	if (p->free + need > dataEnd(p) - p->ntuples*nc - 2) return -1;
+
+	// append new values, then the codes
+	for (k = nold; k < ndict; k++) {
+		Count a = dict[k];
+		memcpy(p->data + p->free, val[a], len[a]);
+		p->data[p->free + len[a]] = '\0';
+		p->free += len[a] + 1;
+	}
+	memcpy(dictCodes(p, p->ntuples), code, nc);
+	p->ntuples++;
+	return OK;
+}
+
+// insert a tuple into a typed page, in binary form
+// if the page has a zone map or signatures, also write the tuple's
+// standard text form into text (MAXTUPLEN bytes)
+// returns -1 if there isn't room, or t isn't of the page's types
+
+static Status addToTypedPage(Page p, Tuple t, char *text)
+{
+	char enc[MAXENCLEN];
+	Count n = encodeTuple(pageTypes(p), p->ncols, t, enc);
+	if (n == 0 || p->free+n > dataEnd(p)-2) return -1;
+	memcpy(p->data + p->free, enc, n);
+	p->free += n;
+	p->ntuples++;
+	if (p->nzones > 0 || p->nsigs > 0)
+		decodeTuple(pageTypes(p), p->ncols, enc, text);
+	return OK;
+}
+
+// give an empty page a layout (for PAX, with ncols attributes)
+// (typed pages get their layout from pageSetTypes())
+
+void pageSetLayout(Page p, Byte layout, Count ncols)
+{
+	assert(p->ntuples == 0);
+	assert(layout < NLAYOUTS && layout != PAGE_TYPED && ncols <= MAXATTRS);
+	p->layout = layout;
+	p->ncols = (layout == PAGE_ROW) ? 0 : ncols;
+	p->free = 0;
+	if (layout == PAGE_PAX) {
+		Offset start = ncols*sizeof(unsigned short);
+		p->free = start;
+		for (Count col = 0; col < ncols; col++) setColStart(p, col, start);
+	}
+}
+
+// give an empty page the typed layout, for tuples of ncols
+// attributes of types types[]
+
+void pageSetTypes(Page p, Count ncols, AttrType *types)
+{
+	assert(p->ntuples == 0 && ncols <= MAXATTRS);
+	p->layout = PAGE_TYPED;
+	p->ncols = ncols;
+	memcpy(p->data, types, ncols*sizeof(AttrType));
+	p->free = ncols*sizeof(AttrType);
+}
+
+Byte pageLayout(Page p) { return p->layout; }
+
+// the attribute types of a typed page (NULL for other layouts)
+
+AttrType *pageTypes(Page p)
+{
+	return (p->layout == PAGE_TYPED) ? (AttrType *)p->data : NULL;
+}
+
+// zone map entries (may be unaligned)
+
+static inline void zoneGet(Page p, Count col, float *min, float *max)
+{
+	char *z = p->data + zoneStart(p) + col*2*sizeof(float);
+	memcpy(min, z, sizeof(float));
+	memcpy(max, z + sizeof(float), sizeof(float));
+}
+
+static inline void zoneSet(Page p, Count col, float min, float max)
+{
+	char *z = p->data + zoneStart(p) + col*2*sizeof(float);
+	memcpy(z, &min, sizeof(float));
+	memcpy(z + sizeof(float), &max, sizeof(float));
+}
+
+// give an empty page a zone map for its first nzones attributes
+// (call before pageSetSigs() and pageSetLayout(); at most MAXZONES)
+
+void pageSetZones(Page p, Count nzones)
+{
+	assert(p->ntuples == 0 && nzones <= MAXZONES);
+	p->nzones = nzones;
+	for (Count col = 0; col < nzones; col++) zoneSet(p, col, INFINITY, -INFINITY);
+}
+
+Count pageZones(Page p) { return p->nzones; }
+
+// widen the zone map to cover a newly added tuple
+
+static void zoneAdd(Page p, Tuple t)
+{
+	char *c = t;
+	for (Count col = 0; col < p->nzones; col++) {
+		char *end;
+		double v = strtod(c, &end);
+		if (end != c && (*end == ',' || *end == '\0') && !isnan(v)) {
+			float min, max, f = (float)v;
+			zoneGet(p, col, &min, &max);
+			if (v < min) min = ((double)f > v) ? nextafterf(f, -INFINITY) : f;
+			if (v > max) max = ((double)f < v) ? nextafterf(f, INFINITY) : f;
+			zoneSet(p, col, min, max);
+		}
+		while (*c != ',' && *c != '\0') c++;
+		if (*c == '\0') break;
+		c++;
+	}
+}
+
+// give an empty page n-gram signatures for the nsigs attributes
+// in attrs[] (ascending; call before pageSetLayout(); at most MAXSIGS)
+
+void pageSetSigs(Page p, Count nsigs, Byte *attrs)
+{
+	assert(p->ntuples == 0 && nsigs <= MAXSIGS);
+	p->nsigs = nsigs;
+	memcpy(p->data + sigStart(p), attrs, nsigs);
+	memset(sigBits(p,0), 0, nsigs*SIGBYTES);
+}
+
+Count pageSigs(Page p) { return p->nsigs; }
+
+// add the trigrams of the len chars at s to signature sig
+
+void ngramSig(char *s, Count len, Byte *sig)
+{
+	for (Count i = 0; i + 3 <= len; i++) {
+		uint32_t g = (Byte)s[i] | (Byte)s[i+1] << 8 | (uint32_t)(Byte)s[i+2] << 16;
+		Count bit = (g * 2654435761U) >> (32 - SIGSHIFT);
+		sig[bit/8] |= 1 << (bit%8);
+	}
+}
+
+// add a newly added tuple's trigrams to the signatures
+
+static void sigAdd(Page p, Tuple t)
+{
+	Byte *attrs = (Byte *)p->data + sigStart(p);
+	char *c = t;
+	Count i = 0;
+	for (Count col = 0; i < p->nsigs; col++) {
+		char *c0 = c;
+		while (*c != ',' && *c != '\0') c++;
+		if (col == attrs[i]) ngramSig(c0, c - c0, sigBits(p,i++));
+		if (*c == '\0') break;
+		c++;
+	}
+}
+
+// could attribute col of a tuple in this page contain every
+// trigram in signature sig? (always TRUE if it has no signature)
+
+Bool pageMayContain(Page p, Count col, Byte *sig)
+{
+	Byte *attrs = (Byte *)p->data + sigStart(p);
+	for (Count i = 0; i < p->nsigs; i++) {
+		if (attrs[i] != col) continue;
+		Byte *ps = sigBits(p,i);
+		for (Count j = 0; j < SIGBYTES; j++)
+			if ((ps[j] & sig[j]) != sig[j]) return FALSE;
+		break;
+	}
+	return TRUE;
+}
+
+// could attribute col of a tuple in this page be a number in [lo,hi]?
+// (always TRUE if the attribute has no zone map)
+
+Bool pageMayHold(Page p, Count col, double lo, double hi)
+{
+	if (col >= p->nzones) return TRUE;
+	float min, max;
+	zoneGet(p, col, &min, &max);
+	return !(max < lo || min > hi);
+}
+
+// set up a scan over the tuples in a page
+
+void startPageScan(Page p, PageScan *s)
+{
+	s->next = 0;
+	s->pos = 0;
+	if (p->layout == PAGE_TYPED) {
+		// binary: no delimiters to find
+		s->pos = p->ncols*sizeof(AttrType);
+		s->nwords = 0;
+		return;
+	}
+	s->nwords = DELIMWORDS(p->free);
+	findDelims(p->data, p->free, s->nuls, p->layout == PAGE_ROW ? s->commas : NULL);
+	if (p->layout == PAGE_PAX) {
+		for (Count col = 0; col < p->ncols; col++) {
+			s->colIdx[col] = 0;
+			s->colPos[col] = colStart(p, col);
+		}
+	}
+	if (p->layout == PAGE_DICT) {
+		s->ndict = 0;
+		for (Offset off = 0; off < p->free; off = nextDelim(s->nuls, s->nwords, off) + 1)
+			s->dictPos[s->ndict++] = off;
+	}
+}
+
+// get the next tuple in a scan; NULL if no more
+// for row pages, the result points into the page;
+// for PAX/DICT pages, the tuple is assembled in buf (MAXTUPLEN bytes),
+// and for typed pages, it is turned back into text there
+
+Tuple nextPageTuple(Page p, PageScan *s, char *buf)
+{
+	if (s->next >= p->ntuples) return NULL;
+	if (p->layout == PAGE_TYPED) {
+		char *f[p->ncols];
+		pageFields(p, s, f);
+		decodeTuple(pageTypes(p), p->ncols, f[0], buf);
+		return buf;
+	}
+	if (p->layout == PAGE_ROW) {
+		char *t = p->data + s->pos;
+		s->last = s->pos;
+		s->pos = nextDelim(s->nuls, s->nwords, s->pos) + 1;
+		s->next++;
+		return t;
+	}
+	char *c = buf;
+	for (Count col = 0; col < p->ncols; col++) {
+		char *v = pageValue(p, s, col, s->next);
+		Count n = strlen(v);
+		memcpy(c, v, n);
+		c += n;
+		*c++ = ',';
+	}
+	*(c-1) = '\0';
+	s->next++;
+	return buf;
+}
+
+// get attribute col of tuple i in a PAX or DICT page
+// in PAX pages, the scan's column cursors only move forward, so i
+// must not be before the last tuple asked for in this column;
+// columns that are not asked about are never read
+
+char *pageValue(Page p, PageScan *s, Count col, Count i)
+{
+	if (p->layout == PAGE_DICT)
+		return p->data + s->dictPos[pageCode(p, s, col, i)];
+	assert(p->layout == PAGE_PAX && col < p->ncols && i < p->ntuples);
+	assert(i >= s->colIdx[col]);
+	while (s->colIdx[col] < i) {
+		s->colPos[col] = nextDelim(s->nuls, s->nwords, s->colPos[col]) + 1;
+		s->colIdx[col]++;
+	}
+	return p->data + s->colPos[col];
+}
+
+// (row pages) copy the tuple last returned by nextPageTuple() into
+// buf, and split it there into its values, as splitTuple() does
+// (the ','s are already known, so no byte is looked at twice)
+// returns the number of values found (at most max)
+
+Count pageSplitTuple(Page p, PageScan *s, char *buf, char **vals, Count max)
+{
+	assert(p->layout == PAGE_ROW && s->next > 0);
+	Offset start = s->last, end = s->pos - 1;
+	memcpy(buf, p->data + start, end - start + 1);
+	Count n = 0;
+	if (max == 0) return 0;
+	vals[n++] = buf;
+	for (Count c = nextDelim(s->commas, s->nwords, start); c < end;
+	     c = nextDelim(s->commas, s->nwords, c + 1)) {
+		buf[c - start] = '\0';
+		if (n == max) break;
+		vals[n++] = buf + (c - start) + 1;
+	}
+	return n;
+}
+
+// (typed pages) move on to the next tuple in a scan, setting
+// fields[i] to where its encoded value of attribute i starts
+// (the encoded tuple starts at fields[0])
+// returns the number of fields (0 if there are no more tuples)
+
+Count pageFields(Page p, PageScan *s, char **fields)
+{
+	assert(p->layout == PAGE_TYPED);
+	if (s->next >= p->ntuples) return 0;
+	AttrType *types = pageTypes(p);
+	char *c = p->data + s->pos;
+	for (Count col = 0; col < p->ncols; col++) {
+		fields[col] = c;
+		c += fieldSize(types[col], c);
+	}
+	s->last = s->pos;
+	s->pos = c - p->data;
+	s->next++;
+	return p->ncols;
+}
+
+// get the dictionary code of attribute col of tuple i in a DICT page
+
+int pageCode(Page p, PageScan *s, Count col, Count i)
+{
+	assert(p->layout == PAGE_DICT && col < p->ncols && i < p->ntuples);
+	return dictCodes(p, i)[col];
+}
+
+// map between layout names and codes
+// returns -1 for an unknown name
+
+static char *layoutNames[NLAYOUTS] = { "row", "pax", "dict", "typed" };
+
+int layoutByName(char *name)
+{
+	for (int i = 0; i < NLAYOUTS; i++)
+		if (strcmp(name, layoutNames[i]) == 0) return i;
+	return -1;
+}
+
+char *layoutName(int layout)
+{
+	return (layout >= 0 && layout < NLAYOUTS) ? layoutNames[layout] : "?";
+}
+
 // extract page info
 char *pageData(Page p) { return p->data; }
 Count pageNTuples(Page p) { return p->ntuples; }
-Offset pageOvflow(Page p) { return p->ovflow; }
+PageID pageOvflow(Page p) { return p->ovflow; }
 void pageSetOvflow(Page p, PageID pid) { p->ovflow = pid; }
 Count pageFreeSpace(Page p) {
-	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
-	return (PAGESIZE-hdr_size-p->free);
+	// codes at the end of a DICT page are also used space
+	Count codes = (p->layout == PAGE_DICT) ? p->ntuples*p->ncols : 0;
+	return (dataEnd(p)-p->free-codes);
 }
+// bytes of data[] for tuples (what is left after zone map and signatures)
+Count pageCapacity(Page p) { return dataEnd(p); }
 
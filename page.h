@@ -13,27 +13,98 @@ EDIT
  - have to because provided interface does not have anything for p->free
  ***********************************************************************/
 
+#include <stddef.h>
+#include "defs.h"
+#include "bits.h"
+#include "schema.h"
+
 struct PageRep {
 	Offset free;   // offset within data[] of free space
-	Offset ovflow; // Offset of overflow page (if any)
 	Count ntuples; // #tuples in this page
+	PageID ovflow; // PageID of overflow page (if any)
+	Byte layout;   // how tuples are stored in data[]
+	Byte ncols;    // #attributes per tuple (PAX pages)
+	Byte nzones;   // #attributes in zone map (0 = no zone map)
+	Byte nsigs;    // #attributes with n-gram signatures (0 = none)
 	char data[1];  // start of data
 };
 
 typedef struct PageRep *Page;
 
-#include "defs.h"
+// size of page header (bytes before data[])
+#define PAGEHDRSIZE offsetof(struct PageRep, data)
+
+// page layouts
+#define PAGE_ROW    0   // tuples stored one after another
+#define PAGE_PAX    1   // each attribute's values stored together
+#define PAGE_DICT   2   // dictionary of values + 1-byte codes per tuple
+#define PAGE_TYPED  3   // tuples encoded in binary (see schema.c)
+#define NLAYOUTS    4
+
+// max #distinct values in a PAGE_DICT page
+#define MAXDICT     255
+
+// max #attributes in a page's zone map
+#define MAXZONES    16
+
+// n-gram signatures: max #attributes, and size of each (2^SIGSHIFT bits)
+#define MAXSIGS     4
+#define SIGSHIFT    9
+#define SIGBYTES    ((1 << SIGSHIFT)/8)
+
+// cursor over the tuples in a page
+// (nuls/commas have a bit for each '\0'/',' in the page's data,
+// found in bulk by startPageScan(); see delim.c)
+typedef struct {
+	Count  next;               // index of next tuple
+	Offset pos;                // row/typed pages: offset of next tuple
+	Offset last;               // row/typed pages: offset of the tuple last returned
+	Count  nwords;             // #words used in nuls and commas
+	Bits   nuls[PAGESIZE/64];
+	Bits   commas[PAGESIZE/64]; // row pages only
+	Count  colIdx[MAXATTRS];   // PAX pages: index of value at colPos
+	Offset colPos[MAXATTRS];   // PAX pages: offset of value in column
+	Count  ndict;              // DICT pages: #dictionary entries
+	unsigned short dictPos[MAXDICT]; // DICT pages: offset of each entry
+} PageScan;
+
 #include "tuple.h"
 
+Page allocPage();
 Page newPage();
+void initPage(Page);
 PageID addPage(FILE *);
+PageID filePages(FILE *);
 Page getPage(FILE *, PageID);
+void readPage(FILE *, PageID, Page);
 Status putPage(FILE *, PageID, Page);
+void prefetchPage(FILE *, PageID);
+void prefetchPages(FILE *, PageID, Count);
 Status addToPage(Page, Tuple);
+void pageSetLayout(Page, Byte, Count);
+void pageSetTypes(Page, Count, AttrType *);
+Byte pageLayout(Page);
+AttrType *pageTypes(Page);
+void pageSetZones(Page, Count);
+Count pageZones(Page);
+Bool pageMayHold(Page, Count, double, double);
+void pageSetSigs(Page, Count, Byte *);
+Count pageSigs(Page);
+void ngramSig(char *, Count, Byte *);
+Bool pageMayContain(Page, Count, Byte *);
+void startPageScan(Page, PageScan *);
+Tuple nextPageTuple(Page, PageScan *, char *);
+Count pageSplitTuple(Page, PageScan *, char *, char **, Count);
+Count pageFields(Page, PageScan *, char **);
+char *pageValue(Page, PageScan *, Count, Count);
+int pageCode(Page, PageScan *, Count, Count);
+int layoutByName(char *);
+char *layoutName(int);
 char *pageData(Page);
 Count pageNTuples(Page);
-Offset pageOvflow(Page);
+PageID pageOvflow(Page);
 void pageSetOvflow(Page, PageID);
 Count pageFreeSpace(Page);
+Count pageCapacity(Page);
 
 #endif
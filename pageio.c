@@ -0,0 +1,445 @@
+// pageio.c ... page I/O backends
+// part of Multi-attribute Linear-hashed Files
+// Moving batches of pages between files and memory
+
+// O_DIRECT and MAP_POPULATE are Linux extensions
+#define _GNU_SOURCE 1
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include "defs.h"
+#include "page.h"
+#include "pageio.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define HAVE_URING 1
+#endif
+#endif
+
+// A PageIO is the I/O backend of an open relation
+// - IO_PREAD reads/writes each page with its own pread/pwrite;
+//   an asynchronous read is a posix_fadvise hint, followed by
+//   a pread when the page is actually needed
+// - IO_URING prepares one io_uring submission per page and
+//   hands a whole batch to the kernel in one io_uring_enter(),
+//   then reaps the completions together
+// - if io_uring can't be set up, IO_URING falls back to IO_PREAD
+// - with direct set, files are switched to O_DIRECT when attached,
+//   so page I/O bypasses the kernel page cache
+// Asynchronous reads and batches share QDEPTH request slots;
+// a request's slot number is its io_uring user_data
+// Several threads may use one PageIO: IO_PREAD batches don't touch
+// the slots, and everything else that does holds the PageIO's lock
+
+#define QDEPTH 64   // max #requests in flight
+
+typedef struct {
+	Bool   busy;   // slot in use
+	Bool   done;   // completion has been reaped
+	int    res;    // result of read/write (bytes or -errno)
+	FILE  *f;      // file being read/written
+	PageID pid;    // page being read/written
+	Page   buf;    // page buffer
+} Request;
+
+struct PageIORep {
+	int     kind;    // IO_PREAD or IO_URING
+	Bool    direct;  // use O_DIRECT on attached files
+	Request req[QDEPTH];
+	pthread_mutex_t lock;  // guards req[] and the ring
+#ifdef HAVE_URING
+	int     ring;    // io_uring file descriptor
+	Count   nqueued; // #submissions prepared but not yet submitted
+	unsigned *sqtail, *sqmask, *sqarray;
+	unsigned *cqhead, *cqtail, *cqmask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void   *sqmap, *cqmap;
+	size_t  sqlen, cqlen, sqeslen;
+#endif
+};
+
+static char *ioNames[NIOKINDS] = { "pread", "uring" };
+
+static int freeSlot(PageIO io);
+static void syncPage(FILE *f, PageID pid, Page buf, Bool write);
+static void prepare(PageIO io, int slot, Bool write);
+static void waitFor(PageIO io, int slot);
+static void complete(PageIO io, int slot, Bool write);
+
+#ifdef HAVE_URING
+
+// set up the submission/completion rings shared with the kernel
+// returns FALSE if io_uring is unavailable
+
+static Bool ringSetup(PageIO io)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	io->ring = syscall(__NR_io_uring_setup, QDEPTH, &p);
+	if (io->ring < 0) return FALSE;
+
+	io->sqlen = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	io->cqlen = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (io->cqlen > io->sqlen) io->sqlen = io->cqlen;
+		io->cqlen = io->sqlen;
+	}
+	io->sqmap = mmap(NULL, io->sqlen, PROT_READ|PROT_WRITE,
+	                 MAP_SHARED|MAP_POPULATE, io->ring, IORING_OFF_SQ_RING);
+	if (io->sqmap == MAP_FAILED) { close(io->ring); return FALSE; }
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		io->cqmap = io->sqmap;
+	else {
+		io->cqmap = mmap(NULL, io->cqlen, PROT_READ|PROT_WRITE,
+		                 MAP_SHARED|MAP_POPULATE, io->ring, IORING_OFF_CQ_RING);
+		if (io->cqmap == MAP_FAILED) {
+			munmap(io->sqmap, io->sqlen); close(io->ring);
+			return FALSE;
+		}
+	}
+	io->sqeslen = p.sq_entries*sizeof(struct io_uring_sqe);
+	io->sqes = mmap(NULL, io->sqeslen, PROT_READ|PROT_WRITE,
+	                MAP_SHARED|MAP_POPULATE, io->ring, IORING_OFF_SQES);
+	if (io->sqes == MAP_FAILED) {
+		if (io->cqmap != io->sqmap) munmap(io->cqmap, io->cqlen);
+		munmap(io->sqmap, io->sqlen); close(io->ring);
+		return FALSE;
+	}
+	char *sq = io->sqmap, *cq = io->cqmap;
+	io->sqtail = (unsigned *)(sq + p.sq_off.tail);
+	io->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	io->sqarray = (unsigned *)(sq + p.sq_off.array);
+	io->cqhead = (unsigned *)(cq + p.cq_off.head);
+	io->cqtail = (unsigned *)(cq + p.cq_off.tail);
+	io->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	io->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	io->nqueued = 0;
+	return TRUE;
+}
+
+static void ringRelease(PageIO io)
+{
+	munmap(io->sqes, io->sqeslen);
+	if (io->cqmap != io->sqmap) munmap(io->cqmap, io->cqlen);
+	munmap(io->sqmap, io->sqlen);
+	close(io->ring);
+}
+
+// submit everything prepared so far, and wait for at least
+// one completion; then record all available completions
+
+static void ringEnter(PageIO io)
+{
+	int n;
+	do {
+		n = syscall(__NR_io_uring_enter, io->ring, io->nqueued, 1,
+		            IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (n < 0 && errno == EINTR);
+	assert(n >= 0);
+	io->nqueued -= n;
+
+	unsigned head = *io->cqhead;
+	while (head != __atomic_load_n(io->cqtail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &io->cqes[head & *io->cqmask];
+		Request *rq = &io->req[cqe->user_data];
+		rq->res = cqe->res;
+		rq->done = TRUE;
+		head++;
+	}
+	__atomic_store_n(io->cqhead, head, __ATOMIC_RELEASE);
+}
+
+#endif
+
+// create a new I/O backend
+
+PageIO newPageIO(int kind, Bool direct)
+{
+	assert(kind >= 0 && kind < NIOKINDS);
+	PageIO io = malloc(sizeof(struct PageIORep));
+	assert(io != NULL);
+	memset(io, 0, sizeof(struct PageIORep));
+	io->kind = IO_PREAD;
+	io->direct = direct;
+	pthread_mutex_init(&io->lock, NULL);
+#ifdef HAVE_URING
+	if (kind == IO_URING && ringSetup(io)) io->kind = IO_URING;
+#endif
+	return io;
+}
+
+// release an I/O backend
+// waits for any requests still in flight (their buffers are freed)
+
+void closePageIO(PageIO io)
+{
+	for (int i = 0; i < QDEPTH; i++) {
+		if (io->req[i].busy) free(finishRead(io, i));
+	}
+#ifdef HAVE_URING
+	if (io->kind == IO_URING) ringRelease(io);
+#endif
+	pthread_mutex_destroy(&io->lock);
+	free(io);
+}
+
+// prepare an open data/overflow file for use with this backend
+// O_DIRECT is only kept if a page-sized read works with it
+// (some filesystems and devices reject it)
+
+void pageIOAttach(PageIO io, FILE *f)
+{
+	if (!io->direct) return;
+	int fd = fileno(f);
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags|O_DIRECT) < 0) return;
+	Page p = allocPage();
+	if (pread(fd, p, PAGESIZE, 0) < 0) fcntl(fd, F_SETFL, flags);
+	free(p);
+}
+
+int pageIOKind(PageIO io) { return io->kind; }
+Bool pageIODirect(PageIO io) { return io->direct; }
+
+// map between backend names and codes
+// returns -1 for an unknown name
+
+int pageIOByName(char *name)
+{
+	for (int i = 0; i < NIOKINDS; i++)
+		if (strcmp(name, ioNames[i]) == 0) return i;
+	return -1;
+}
+
+char *pageIOName(int kind)
+{
+	return (kind >= 0 && kind < NIOKINDS) ? ioNames[kind] : "?";
+}
+
+// find an unused request slot; returns -1 if all in use
+
+static int freeSlot(PageIO io)
+{
+	for (int i = 0; i < QDEPTH; i++)
+		if (!io->req[i].busy) return i;
+	return -1;
+}
+
+// queue the read/write described in a request slot
+// (for IO_PREAD, nothing happens until the request is completed)
+
+static void prepare(PageIO io, int slot, Bool write)
+{
+	Request *rq = &io->req[slot];
+	rq->busy = TRUE;
+	rq->done = FALSE;
+#ifdef HAVE_URING
+	if (io->kind == IO_URING) {
+		unsigned tail = *io->sqtail;
+		unsigned idx = tail & *io->sqmask;
+		struct io_uring_sqe *sqe = &io->sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = fileno(rq->f);
+		sqe->addr = (unsigned long)rq->buf;
+		sqe->len = PAGESIZE;
+		sqe->off = (off_t)rq->pid*PAGESIZE;
+		sqe->user_data = slot;
+		io->sqarray[idx] = idx;
+		__atomic_store_n(io->sqtail, tail+1, __ATOMIC_RELEASE);
+		io->nqueued++;
+	}
+#endif
+}
+
+// wait until the request in a slot has completed
+
+static void waitFor(PageIO io, int slot)
+{
+#ifdef HAVE_URING
+	if (io->kind == IO_URING) {
+		while (!io->req[slot].done) ringEnter(io);
+		return;
+	}
+#endif
+	io->req[slot].done = TRUE;
+	io->req[slot].res = -EAGAIN;
+}
+
+// finish off a request whose completion has been seen
+// anything short of a whole page (or a pread-backend request)
+// is (re)done synchronously; then the slot is released
+
+static void complete(PageIO io, int slot, Bool write)
+{
+	Request *rq = &io->req[slot];
+	if (rq->res != PAGESIZE) {
+		int fd = fileno(rq->f);
+		ssize_t n;
+		if (write)
+			n = pwrite(fd, rq->buf, PAGESIZE, (off_t)rq->pid*PAGESIZE);
+		else
+			n = pread(fd, rq->buf, PAGESIZE, (off_t)rq->pid*PAGESIZE);
+		assert(n == PAGESIZE);
+	}
+	rq->busy = FALSE;
+}
+
+// read or write one page at once, with pread()/pwrite()
+
+static void syncPage(FILE *f, PageID pid, Page buf, Bool write)
+{
+	int fd = fileno(f);
+	off_t off = (off_t)pid*PAGESIZE;
+	ssize_t m = write ? pwrite(fd, buf, PAGESIZE, off)
+	                  : pread(fd, buf, PAGESIZE, off);
+	assert(m == PAGESIZE);
+}
+
+// run a batch of n page reads or writes,
+// as many per submission as there are free slots
+// (a page is done at once if no slot is free)
+
+static void runBatch(PageIO io, FILE *f, Count n, PageID *pids, Page *pages, Bool write)
+{
+	if (io->kind == IO_PREAD) {
+		// one syscall per page anyway, so skip the request slots
+		for (Count i = 0; i < n; i++) syncPage(f, pids[i], pages[i], write);
+		return;
+	}
+
+	int slots[QDEPTH];
+	Count i = 0;
+	pthread_mutex_lock(&io->lock);
+	while (i < n) {
+		Count m = 0;
+		int slot;
+		while (i+m < n && (slot = freeSlot(io)) >= 0) {
+			Request *rq = &io->req[slot];
+			rq->f = f;
+			rq->pid = pids[i+m];
+			rq->buf = pages[i+m];
+			prepare(io, slot, write);
+			slots[m++] = slot;
+		}
+		if (m == 0) {
+			// every slot is held by reads that open scans
+			// have started; don't wait for them to finish
+			syncPage(f, pids[i], pages[i], write);
+			i++;
+			continue;
+		}
+		for (Count k = 0; k < m; k++) {
+			waitFor(io, slots[k]);
+			complete(io, slots[k], write);
+		}
+		i += m;
+	}
+	pthread_mutex_unlock(&io->lock);
+}
+
+// read n pages into newly allocated buffers
+
+void readPages(PageIO io, FILE *f, Count n, PageID *pids, Page *pages)
+{
+	for (Count i = 0; i < n; i++) pages[i] = allocPage();
+	runBatch(io, f, n, pids, pages, FALSE);
+}
+
+// write n pages; release their buffers
+
+void writePages(PageIO io, FILE *f, Count n, PageID *pids, Page *pages)
+{
+	runBatch(io, f, n, pids, pages, TRUE);
+	for (Count i = 0; i < n; i++) free(pages[i]);
+}
+
+// as readPages() and writePages(), but with the caller's
+// buffers, which are neither allocated nor released
+
+void readPagesInto(PageIO io, FILE *f, Count n, PageID *pids, Page *pages)
+{
+	runBatch(io, f, n, pids, pages, FALSE);
+}
+
+void writePagesFrom(PageIO io, FILE *f, Count n, PageID *pids, Page *pages)
+{
+	runBatch(io, f, n, pids, pages, TRUE);
+}
+
+// read up to n consecutive pages, from page first on, into buf
+// (room for n pages, one after another); used for sequential scans
+// the whole run is one pread, whatever the backend: a single large
+// read needs no batching, and lets the kernel read ahead
+// returns the #pages read, which is less than n at the end of the file
+
+Count readRun(PageIO io, FILE *f, PageID first, Count n, Page buf)
+{
+	(void)io;
+	int fd = fileno(f);
+	char *b = (char *)buf;
+	size_t want = (size_t)n*PAGESIZE, got = 0;
+	while (got < want) {
+		ssize_t m = pread(fd, b + got, want - got, (off_t)first*PAGESIZE + got);
+		if (m < 0 && errno == EINTR) continue;
+		assert(m >= 0);
+		if (m == 0) break;
+		got += m;
+	}
+	return got / PAGESIZE;
+}
+
+// start reading a page; returns a request number for finishRead(),
+// or -1 if all QDEPTH requests are in use (nothing is read; the
+// caller should read the page itself, e.g. with getPage())
+
+int startRead(PageIO io, FILE *f, PageID pid)
+{
+	Page buf = allocPage();
+	int req = startReadInto(io, f, pid, buf);
+	if (req < 0) free(buf);
+	return req;
+}
+
+// start reading a page into the caller's buffer buf
+// (finishRead() gives buf back)
+// returns -1, as startRead() does, if no request is free
+
+int startReadInto(PageIO io, FILE *f, PageID pid, Page buf)
+{
+	pthread_mutex_lock(&io->lock);
+	int slot = freeSlot(io);
+	if (slot < 0) {
+		pthread_mutex_unlock(&io->lock);
+		return -1;
+	}
+	Request *rq = &io->req[slot];
+	rq->f = f;
+	rq->pid = pid;
+	rq->buf = buf;
+	prepare(io, slot, FALSE);
+	pthread_mutex_unlock(&io->lock);
+	if (io->kind == IO_PREAD) prefetchPage(f, pid);
+	return slot;
+}
+
+// wait for a page started by startRead(); caller owns the buffer
+
+Page finishRead(PageIO io, int req)
+{
+	pthread_mutex_lock(&io->lock);
+	assert(req >= 0 && req < QDEPTH && io->req[req].busy);
+	Page p = io->req[req].buf;
+	waitFor(io, req);
+	complete(io, req, FALSE);
+	pthread_mutex_unlock(&io->lock);
+	return p;
+}
@@ -0,0 +1,38 @@
+// pageio.h ... interface to page I/O backends
+// part of Multi-attribute Linear-hashed Files
+// See pageio.c for details of PageIO type and functions
+
+#ifndef PAGEIO_H
+#define PAGEIO_H 1
+
+typedef struct PageIORep *PageIO;
+
+#include "defs.h"
+#include "page.h"
+
+// I/O backends
+#define IO_PREAD    0   // pread/pwrite, one page per syscall (default)
+#define IO_URING    1   // io_uring, many pages per syscall
+#define NIOKINDS    2
+
+PageIO newPageIO(int kind, Bool direct);
+void closePageIO(PageIO io);
+void pageIOAttach(PageIO io, FILE *f);
+int pageIOKind(PageIO io);
+Bool pageIODirect(PageIO io);
+int pageIOByName(char *name);
+char *pageIOName(int kind);
+
+// batched synchronous I/O
+void readPages(PageIO io, FILE *f, Count n, PageID *pids, Page *pages);
+void writePages(PageIO io, FILE *f, Count n, PageID *pids, Page *pages);
+void readPagesInto(PageIO io, FILE *f, Count n, PageID *pids, Page *pages);
+void writePagesFrom(PageIO io, FILE *f, Count n, PageID *pids, Page *pages);
+Count readRun(PageIO io, FILE *f, PageID first, Count n, Page buf);
+
+// asynchronous reads
+int startRead(PageIO io, FILE *f, PageID pid);
+int startReadInto(PageIO io, FILE *f, PageID pid, Page buf);
+Page finishRead(PageIO io, int req);
+
+#endif
@@ -9,31 +9,102 @@
 #include "reln.h"
 #include "tuple.h"
 #include "util.h"
+#include "hash.h"
 
+// DISTINCT projections (distinct=on) drop repeated rows
+// - rows are remembered by a 64-bit fingerprint (a hash of the
+//   row), kept in an open-addressing hash set; two different rows
+//   with the same fingerprint would be taken as one, but that is
+//   very unlikely (about n^2/2^65 for n distinct rows)
+// - if the projected attributes choose the bucket (see
+//   bucketChosenBy()), equal rows are always in the same bucket,
+//   and the set only holds one bucket's rows at a time
+// - fingerprints fall into DPARTS partitions (by their top bits);
+//   if the set would outgrow the memory budget, the largest
+//   partition is spilled: its fingerprints go to a temporary file,
+//   and later rows in that partition are written to another one
+//   rather than output; once the scan is over, each spilled
+//   partition's rows are deduplicated on their own (in memory,
+//   whatever the budget; a partition holds about 1/DPARTS of them)
+
+#define DPARTS      16           // #partitions (power of 2)
+#define DPARTSHIFT  60           // fingerprint >> DPARTSHIFT = partition
+#define DMINSLOTS   1024         // initial set size (power of 2)
+#define DMEMORY     (16<<20)     // default memory budget (memory=SIZE)
 
 
 /*NEW*/
 struct ProjectionRep {
 	Reln        rel;          // need to remember Relation info
     Count       nPA;          //     number of projected attributes
-    char**      projected;    // record the projected attributes
-                              // in an array of string
-                              // use string to save memory
+    Count*      projected;    // the projected attributes, as 0-based
+                              // attribute numbers (NULL if '*')
+    // DISTINCT projections only
+    Bool        distinct;
+    size_t      memory;       // max bytes for the fingerprint set
+    Bits*       fps;          // fingerprint set (0 = empty slot)
+    Count       nslots;
+    Count       nfps;
+    Count       partSize[DPARTS]; // #fingerprints in the set from each partition
+    int         perBucket;    // dedupe per bucket? (-1 = not known yet)
+    PageID      bid;          // bucket whose rows are in the set
+    FILE*       seen[DPARTS]; // spilled partitions: fingerprints of rows output,
+    FILE*       rows[DPARTS]; //   and rows not yet output (NULL if not spilled)
+    Count       drain;        // spilled partition being output
+    Bool        draining;     // ... its fingerprints are in the set
 };
 
+static Status parseProjOpts(Projection p, char *opts);
+static Bits fingerprint(char *row, Count len);
+static Bool fpInsert(Projection p, Bits fp);
+static void fpClear(Projection p);
+static void fpResize(Projection p, Count nslots);
+static void spillPart(Projection p);
+
 
 
 
 /*EDIT*/
 // take a string of 1-based attribute indexes (e.g. "1,3,4")
 // set up a ProjectionRep object for the Projection
+// the indexes are converted to attribute numbers once, here
+// returns NULL if any index is not a valid attribute, or is repeated
 Projection startProjection(Reln r, char *attrstr)
+{
+    return startProjectionOpts(r, attrstr, "");
+}
+
+
+
+/*NEW*/
+// as startProjection(), with options
+// opts is a comma-separated list of key=value settings
+//   distinct=on|off   getNextProjected() gives each distinct
+//                     row once (default: off)
+//   memory=SIZE       memory budget for distinct=on before rows
+//                     are spilled to temporary files (suffix k or m;
+//                     default: 16m)
+// returns NULL (after saying why) if the options are invalid
+Projection startProjectionOpts(Reln r, char *attrstr, char *opts)
 {
 
     Projection new = malloc(sizeof(struct ProjectionRep));
     assert(new != NULL);
 
     new->rel = r;
+    new->distinct = FALSE;
+    new->memory = DMEMORY;
+    new->fps = NULL;
+    new->nslots = new->nfps = 0;
+    new->perBucket = -1;
+    new->bid = NO_PAGE;
+    new->drain = 0;
+    new->draining = FALSE;
+    for (Count i = 0; i < DPARTS; i++) {
+        new->seen[i] = new->rows[i] = NULL;
+        new->partSize[i] = 0;
+    }
+    if (parseProjOpts(new, opts) != OK) { free(new); return NULL; }
 
     //get the list of attribute
     // if it is '*' - project all
@@ -48,49 +119,113 @@ Projection startProjection(Reln r, char *attrstr)
         for (char* c = attrstr; *c != '\0'; c++) { if (*c == ',') nPA += 1; }
         nPA += 1;
 
-        //extract attribute indexes (string)
-        new->projected = (char**) malloc(nPA * sizeof(char *));
+        //extract attribute numbers
+        //each at most once, so a projected tuple is never longer
+        //than the tuple (callers' buffers are MAXTUPLEN bytes)
+        new->projected = malloc(nPA * sizeof(Count));
         assert(new->projected != NULL);
-        tupleVals(attrstr, new->projected);
+        Bool* seen = calloc(nattrs(r), sizeof(Bool));
+        assert(seen != NULL);
+        char* c = attrstr;
+        for (Count i = 0; i < nPA; i++) {
+            char* end;
+            long a = strtol(c, &end, 10);
+            if (end == c || a < 1 || a > nattrs(r) || (*end != ',' && *end != '\0')
+                || seen[a - 1]) {
+                printf("Invalid projected attribute: %s\n", c);
+                free(seen); free(new->projected); free(new);
+                return NULL;
+            }
+            seen[a - 1] = TRUE;
+            new->projected[i] = a - 1;
+            c = end + 1;
+        }
+        free(seen);
 
         //number of projected attributes
         new->nPA = nPA; 
                      
     }
+
+    if (new->distinct) fpResize(new, DMINSLOTS);
    
     return new;
 }
 
 
 
+/*NEW*/
+// parse the options string given to startProjectionOpts()
+static Status parseProjOpts(Projection p, char *opts)
+{
+    char    buf[MAXERRMSG];
+    char    *c, *key, *val, *save;
+
+    if (opts == NULL) return OK;
+    if (strlen(opts) >= MAXERRMSG) {
+        printf("Projection options too long\n");
+        return ~OK;
+    }
+    strcpy(buf, opts);
+    for (c = strtok_r(buf, ",", &save); c != NULL; c = strtok_r(NULL, ",", &save)) {
+        key = c;
+        val = strchr(c, '=');
+        if (val == NULL) {
+            printf("Invalid projection option: %s\n", c);
+            return ~OK;
+        }
+        *val++ = '\0';
+        if (strcmp(key, "distinct") == 0) {
+            if (strcmp(val, "on") != 0 && strcmp(val, "off") != 0) {
+                printf("Invalid distinct option: %s\n", val);
+                return ~OK;
+            }
+            p->distinct = (strcmp(val, "on") == 0);
+        }
+        else if (strcmp(key, "memory") == 0) {
+            if (parseSize(val, &p->memory) != 0 || p->memory < DMINSLOTS * sizeof(Bits)) {
+                printf("Invalid memory size: %s\n", val);
+                return ~OK;
+            }
+        }
+        else {
+            printf("Unknown projection option: %s\n", key);
+            return ~OK;
+        }
+    }
+    return OK;
+}
+
+
+
 // DONE: Implement projection of tuple 't' according to 'p' and store result in 'buf'
+// the tuple is split into values once, and only the projected
+// values are copied into buf
 void projectTuple(Projection p, Tuple t, char *buf)
 {
-    memset(buf, '\0', sizeof(char)*MAXTUPLEN);
-
     // IF PROJECT ALL
     if (p->projected == NULL) {
-        memcpy(buf, t, sizeof(char)*strlen(t));
+        strcpy(buf, t);
     } else {
 
     // IF PROJECT SUBSET ONLY
-        // get all attributes in tuple 
-        Count nvals = nattrs(p->rel);
-        char **vals = malloc(nvals*sizeof(char *));
-        tupleVals(t, vals);
+        // split (a copy of) the tuple into attribute values
+        char    tmp[MAXTUPLEN];
+        char*   vals[MAXATTRS];
+        strcpy(tmp, t);
+        splitTuple(tmp, vals, MAXATTRS);
 
         //copy projected attrs into buffer string 
         //in query order
-        Offset  bfree = 0;
+        char*   c = buf;
         for (int i = 0; i < p->nPA; i ++) {
-            Count j = atoi(p->projected[i]) - 1;
-            Count lenA = strlen(vals[j]);
-            memcpy(buf + bfree, vals[j], lenA);
-            buf[bfree + lenA] = ',';
-            bfree = bfree + lenA +1;
+            char*   v = vals[p->projected[i]];
+            Count   lenA = strlen(v);
+            memcpy(c, v, lenA);
+            c[lenA] = ',';
+            c += lenA + 1;
         }
-        buf[bfree - 1] = '\0';
-        freeVals(vals, nvals);
+        *(c - 1) = '\0';
     }    
     
     if (t!= NULL) free(t);
@@ -98,9 +233,222 @@ void projectTuple(Projection p, Tuple t, char *buf)
 }
 
 
+
+// project every tuple in batch in into batch out
+// (out must be able to hold in->ntuples tuples)
+void projectBatch(Projection p, TupleBatch *in, TupleBatch *out)
+{
+    char*   vals[MAXATTRS];
+    char    tmp[MAXTUPLEN];
+
+    assert(out->max >= in->ntuples);
+    clearTupleBatch(out);
+
+    for (Count t = 0; t < in->ntuples; t++) {
+        char*   c = batchSpace(out);
+        if (p->projected == NULL) {
+            memcpy(c, in->tuples[t], in->lens[t] + 1);
+            batchAdd(out, in->lens[t]);
+            continue;
+        }
+        memcpy(tmp, in->tuples[t], in->lens[t] + 1);
+        splitTuple(tmp, vals, MAXATTRS);
+        for (int i = 0; i < p->nPA; i ++) {
+            char*   v = vals[p->projected[i]];
+            Count   lenA = strlen(v);
+            memcpy(c, v, lenA);
+            c[lenA] = ',';
+            c += lenA + 1;
+        }
+        *(c - 1) = '\0';
+        batchAdd(out, (c - 1) - batchSpace(out));
+    }
+}
+
+
+
+// number of projected attributes, and the
+// attribute number of the i'th of them
+Count projectionSize(Projection p) { return p->nPA; }
+Count projectedAttr(Projection p, Count i)
+{
+    return (p->projected == NULL) ? i : p->projected[i];
+}
+Bool projectsAll(Projection p) { return p->projected == NULL; }
+Bool projectionDistinct(Projection p) { return p->distinct; }
+
+
+
+/*NEW*/
+// (distinct=on) should projected row (of length len), which came
+// from bucket bid of a relation with shape snap, be output now?
+// FALSE if it has been output already, or if it is put aside
+// in a spilled partition (see nextSpilledRow())
+Bool distinctRow(Projection p, RelnSnapshot *snap, PageID bid, char *row, Count len)
+{
+    if (p->perBucket < 0) {
+        Count attrs[p->nPA];
+        for (Count i = 0; i < p->nPA; i++) attrs[i] = projectedAttr(p, i);
+        p->perBucket = bucketChosenBy(p->rel, snap, p->nPA, attrs);
+    }
+    if (p->perBucket && bid != p->bid) {
+        fpClear(p);
+        p->bid = bid;
+    }
+
+    Bits    fp = fingerprint(row, len);
+    FILE*   f = p->rows[fp >> DPARTSHIFT];
+    if (f != NULL) {
+        fwrite(row, 1, len, f);
+        putc('\n', f);
+        return FALSE;
+    }
+    return fpInsert(p, fp);
+}
+
+
+
+/*NEW*/
+// (distinct=on, once the scan is over) get the next distinct
+// row from the spilled partitions into buf
+// returns FALSE when there are no more
+Bool nextSpilledRow(Projection p, char *buf)
+{
+    for (; p->drain < DPARTS; p->drain++) {
+        Count   i = p->drain;
+        if (p->rows[i] == NULL) continue;
+
+        // the set starts with the partition's rows already output
+        if (!p->draining) {
+            Bits    fp;
+            fpClear(p);
+            p->draining = TRUE;
+            rewind(p->seen[i]);
+            while (fread(&fp, sizeof(Bits), 1, p->seen[i]) == 1) fpInsert(p, fp);
+            rewind(p->rows[i]);
+        }
+        while (fgets(buf, MAXTUPLEN + 1, p->rows[i]) != NULL) {
+            Count   len = strcspn(buf, "\n");
+            buf[len] = '\0';
+            if (fpInsert(p, fingerprint(buf, len))) return TRUE;
+        }
+        fclose(p->seen[i]);
+        fclose(p->rows[i]);
+        p->seen[i] = p->rows[i] = NULL;
+        p->draining = FALSE;
+    }
+    return FALSE;
+}
+
+
+
+/*NEW*/
+// fingerprint of a row (never 0, which marks an empty slot)
+static Bits fingerprint(char *row, Count len)
+{
+    Bits    fp = hashValue(HASH_WY, (unsigned char *)row, len);
+    return (fp == 0) ? 1 : fp;
+}
+
+
+
+/*NEW*/
+// add fp to the set; returns FALSE if it was there already
+// the set doubles when 3/4 full, unless that would go over the
+// memory budget, when a partition is spilled instead
+// (while a spilled partition is being output, it always doubles)
+static Bool fpInsert(Projection p, Bits fp)
+{
+    Count   mask = p->nslots - 1;
+    Count   i = fp & mask;
+    while (p->fps[i] != 0) {
+        if (p->fps[i] == fp) return FALSE;
+        i = (i + 1) & mask;
+    }
+    p->fps[i] = fp;
+    p->nfps++;
+    p->partSize[fp >> DPARTSHIFT]++;
+
+    if (p->nfps * 4 > p->nslots * 3) {
+        if (p->draining || 2 * p->nslots * sizeof(Bits) <= p->memory)
+            fpResize(p, 2 * p->nslots);
+        else
+            spillPart(p);
+    }
+    return TRUE;
+}
+
+
+
+/*NEW*/
+// empty the set
+static void fpClear(Projection p)
+{
+    memset(p->fps, 0, p->nslots * sizeof(Bits));
+    p->nfps = 0;
+    for (Count i = 0; i < DPARTS; i++) p->partSize[i] = 0;
+}
+
+
+
+/*NEW*/
+// move the set's fingerprints into a table of nslots slots
+static void fpResize(Projection p, Count nslots)
+{
+    Bits*   old = p->fps;
+    Count   nold = p->nslots;
+
+    p->fps = calloc(nslots, sizeof(Bits));
+    assert(p->fps != NULL);
+    p->nslots = nslots;
+    p->nfps = 0;
+    for (Count i = 0; i < DPARTS; i++) p->partSize[i] = 0;
+    for (Count k = 0; k < nold; k++) {
+        Bits    fp = old[k];
+        if (fp == 0) continue;
+        Count   i = fp & (nslots - 1);
+        while (p->fps[i] != 0) i = (i + 1) & (nslots - 1);
+        p->fps[i] = fp;
+        p->nfps++;
+        p->partSize[fp >> DPARTSHIFT]++;
+    }
+    free(old);
+}
+
+
+
+/*NEW*/
+// spill the partition with the most fingerprints in the set,
+// and take its fingerprints out of the set
+static void spillPart(Projection p)
+{
+    Count   big = 0;
+    for (Count i = 1; i < DPARTS; i++)
+        if (p->partSize[i] > p->partSize[big]) big = i;
+
+    p->seen[big] = tmpfile();
+    p->rows[big] = tmpfile();
+    if (p->seen[big] == NULL || p->rows[big] == NULL)
+        fatal("Can't create projection spill file");
+    for (Count k = 0; k < p->nslots; k++) {
+        Bits    fp = p->fps[k];
+        if (fp != 0 && (fp >> DPARTSHIFT) == big) {
+            fwrite(&fp, sizeof(Bits), 1, p->seen[big]);
+            p->fps[k] = 0;
+        }
+    }
+    fpResize(p, p->nslots);
+}
+
+
 //DONE
 void closeProjection(Projection p)
 {
-    if (p->projected != NULL) freeVals(p->projected, p->nPA);
+    for (Count i = 0; i < DPARTS; i++) {
+        if (p->seen[i] != NULL) fclose(p->seen[i]);
+        if (p->rows[i] != NULL) fclose(p->rows[i]);
+    }
+    free(p->fps);
+    if (p->projected != NULL) free(p->projected);
     free(p);
 }
@@ -12,7 +12,15 @@ typedef struct ProjectionRep *Projection;
 #include "tuple.h"
 
 Projection startProjection(Reln r, char *attrstr);
+Projection startProjectionOpts(Reln r, char *attrstr, char *opts);
 void projectTuple(Projection p, Tuple t, char *buf);
+void projectBatch(Projection p, TupleBatch *in, TupleBatch *out);
+Count projectionSize(Projection p);
+Count projectedAttr(Projection p, Count i);
+Bool projectsAll(Projection p);
+Bool projectionDistinct(Projection p);
+Bool distinctRow(Projection p, RelnSnapshot *snap, PageID bid, char *row, Count len);
+Bool nextSpilledRow(Projection p, char *buf);
 void closeProjection(Projection p);
 
 #endif
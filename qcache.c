@@ -0,0 +1,321 @@
+// qcache.c ... query result cache
+// part of Multi-attribute Linear-hashed Files
+// Manage creating and using QCache objects
+
+#include "defs.h"
+#include "qcache.h"
+#include "reln.h"
+#include "hash.h"
+
+// A QCache holds the results of recent queries on one open relation,
+// keyed on the (normalised) query string
+//
+// Each result (a QResult) records the buckets its query read and
+// the version of each bucket at the time (see bucketVersion() in
+// reln.c); a write to a bucket bumps its version, so a result is
+// only used if none of its buckets has changed since; stale
+// results are dropped when they are next looked up
+//
+// Results are charged to a memory budget by their size; the least
+// recently used ones are evicted to make room, and a result bigger
+// than a quarter of the budget is not kept at all
+//
+// A result in use by a scan is pinned (refs > 0), and is only freed
+// once it is both out of the cache and unpinned
+
+#define MINSLOTS   64   // initial table size (power of 2)
+#define MAXSHARE   4    // max result size is budget/MAXSHARE
+
+struct QResultRep {
+	struct QResultRep *next;   // next in hash chain
+	struct QResultRep *newer;  // LRU list
+	struct QResultRep *older;
+	Bits     hash;             // of key
+	char    *key;
+	Count    nbuckets;         // buckets read, and their versions
+	Count    maxbuckets;
+	PageID  *bids;
+	uint64_t *versions;
+	uint64_t ntuples;          // matching tuples, each '\0'-terminated
+	char    *data;
+	size_t   used;
+	size_t   max;
+	size_t   limit;            // max size while being built
+	size_t   size;             // bytes charged to the budget
+	Count    refs;
+	Bool     cached;           // in a cache's table
+};
+
+struct QCacheRep {
+	size_t   budget;           // max bytes of results
+	size_t   used;
+	QResult *slots;            // hash table (chained)
+	Count    nslots;
+	Count    nentries;
+	QResult  newest;           // LRU list
+	QResult  oldest;
+	uint64_t lookups, hits, stale, evicted;
+};
+
+static size_t resultSize(QResult e);
+static void unlinkResult(QCache c, QResult e);
+static void growTable(QCache c);
+
+
+// create an empty cache that holds up to budget bytes of results
+
+QCache newQCache(size_t budget)
+{
+	QCache c = malloc(sizeof(struct QCacheRep));
+	assert(c != NULL);
+	c->budget = budget;
+	c->used = 0;
+	c->nslots = MINSLOTS;
+	c->slots = calloc(c->nslots, sizeof(QResult));
+	assert(c->slots != NULL);
+	c->nentries = 0;
+	c->newest = c->oldest = NULL;
+	c->lookups = c->hits = c->stale = c->evicted = 0;
+	return c;
+}
+
+// release a cache and all of its results
+// (no scan should still be using one)
+
+void freeQCache(QCache c)
+{
+	while (c->oldest != NULL) unlinkResult(c, c->oldest);
+	free(c->slots);
+	free(c);
+}
+
+// find the result for query key, if it is still up to date
+// for relation r; the result is pinned (see qresultRelease())
+// returns NULL if there is none
+
+QResult qcacheLookup(QCache c, Reln r, char *key)
+{
+	c->lookups++;
+	Count klen = strlen(key);
+	Bits h = hashValue(HASH_WY, (unsigned char *)key, klen);
+	QResult e = c->slots[h & (c->nslots - 1)];
+	while (e != NULL && (e->hash != h || strcmp(e->key, key) != 0))
+		e = e->next;
+	if (e == NULL) return NULL;
+
+	for (Count i = 0; i < e->nbuckets; i++) {
+		if (bucketVersion(r, e->bids[i]) != e->versions[i]) {
+			c->stale++;
+			unlinkResult(c, e);
+			return NULL;
+		}
+	}
+
+	// move to the front of the LRU list
+	if (c->newest != e) {
+		e->newer->older = e->older;
+		if (e->older != NULL) e->older->newer = e->newer;
+		else c->oldest = e->newer;
+		e->newer = NULL;
+		e->older = c->newest;
+		c->newest->newer = e;
+		c->newest = e;
+	}
+	c->hits++;
+	e->refs++;
+	return e;
+}
+
+// add a finished result to the cache, evicting older ones to
+// make room; it replaces any result already there for its key
+// the caller's pin on e is handed over to the cache
+
+void qcacheInsert(QCache c, QResult e)
+{
+	assert(!e->cached);
+	e->size = resultSize(e);
+	if (e->size > c->budget / MAXSHARE) {
+		qresultRelease(e);    // drop the caller's pin (freeing e if it was the last)
+		return;
+	}
+	e->refs--;
+	// trim buffers to their contents (they are charged by size)
+	if (e->used < e->max) {
+		char *d = realloc(e->data, e->used > 0 ? e->used : 1);
+		if (d != NULL) { e->data = d; e->max = e->used; }
+	}
+
+	Count klen = strlen(e->key);
+	e->hash = hashValue(HASH_WY, (unsigned char *)e->key, klen);
+	for (QResult x = c->slots[e->hash & (c->nslots - 1)]; x != NULL; x = x->next) {
+		if (x->hash == e->hash && strcmp(x->key, e->key) == 0) {
+			unlinkResult(c, x);
+			break;
+		}
+	}
+	while (c->used + e->size > c->budget && c->oldest != NULL) {
+		c->evicted++;
+		unlinkResult(c, c->oldest);
+	}
+
+	Count i = e->hash & (c->nslots - 1);
+	e->next = c->slots[i];
+	c->slots[i] = e;
+	e->newer = NULL;
+	e->older = c->newest;
+	if (c->newest != NULL) c->newest->newer = e;
+	else c->oldest = e;
+	c->newest = e;
+	e->cached = TRUE;
+	c->used += e->size;
+	c->nentries++;
+	if (c->nentries * 4 > c->nslots * 3) growTable(c);
+}
+
+// display the cache's size and hit ratio
+
+void qcacheStats(QCache c)
+{
+	printf("Cache: %"PRIu64" lookups, %"PRIu64" hits (%.1f%%), "
+	       "%"PRIu64" stale, %"PRIu64" evicted; %d results, %zu/%zu bytes\n",
+	       c->lookups, c->hits,
+	       c->lookups > 0 ? 100.0 * c->hits / c->lookups : 0.0,
+	       c->stale, c->evicted, c->nentries, c->used, c->budget);
+}
+
+
+
+// start building the result of query key (pinned; see qcacheInsert())
+
+QResult newQResult(QCache c, char *key)
+{
+	QResult e = malloc(sizeof(struct QResultRep));
+	assert(e != NULL);
+	e->key = copyString(key);
+	e->nbuckets = 0;
+	e->maxbuckets = 8;
+	e->bids = malloc(e->maxbuckets * sizeof(PageID));
+	e->versions = malloc(e->maxbuckets * sizeof(uint64_t));
+	assert(e->bids != NULL && e->versions != NULL);
+	e->ntuples = 0;
+	e->used = 0;
+	e->max = 1024;
+	e->data = malloc(e->max);
+	assert(e->data != NULL);
+	e->limit = c->budget / MAXSHARE;
+	e->size = 0;
+	e->refs = 1;
+	e->cached = FALSE;
+	e->next = e->newer = e->older = NULL;
+	return e;
+}
+
+// note that the query reads bucket bid, which is at this version
+// returns ~OK if the result has got too big to cache
+
+Status qresultAddBucket(QResult e, PageID bid, uint64_t version)
+{
+	if (e->nbuckets == e->maxbuckets) {
+		e->maxbuckets *= 2;
+		e->bids = realloc(e->bids, e->maxbuckets * sizeof(PageID));
+		e->versions = realloc(e->versions, e->maxbuckets * sizeof(uint64_t));
+		assert(e->bids != NULL && e->versions != NULL);
+	}
+	e->bids[e->nbuckets] = bid;
+	e->versions[e->nbuckets] = version;
+	e->nbuckets++;
+	return (resultSize(e) > e->limit) ? ~OK : OK;
+}
+
+// add a matching tuple (of length len) to the result
+// returns ~OK if the result has got too big to cache
+
+Status qresultAddTuple(QResult e, char *t, Count len)
+{
+	if (e->used + len + 1 > e->max) {
+		while (e->used + len + 1 > e->max) e->max *= 2;
+		e->data = realloc(e->data, e->max);
+		assert(e->data != NULL);
+	}
+	memcpy(e->data + e->used, t, len);
+	e->data[e->used + len] = '\0';
+	e->used += len + 1;
+	e->ntuples++;
+	return (resultSize(e) > e->limit) ? ~OK : OK;
+}
+
+uint64_t qresultNTuples(QResult e) { return e->ntuples; }
+
+// the tuple at offset *pos in the result, and advance *pos past it
+// (start with *pos = 0); returns NULL after the last one
+
+char *qresultTuple(QResult e, size_t *pos)
+{
+	if (*pos >= e->used) return NULL;
+	char *t = e->data + *pos;
+	*pos += strlen(t) + 1;
+	return t;
+}
+
+// unpin a result (or discard one that is being built)
+
+void qresultRelease(QResult e)
+{
+	assert(e->refs > 0);
+	if (--e->refs > 0 || e->cached) return;
+	free(e->key);
+	free(e->bids);
+	free(e->versions);
+	free(e->data);
+	free(e);
+}
+
+
+
+// #bytes a result takes up
+
+static size_t resultSize(QResult e)
+{
+	return sizeof(struct QResultRep) + strlen(e->key) + 1
+	     + e->nbuckets * (sizeof(PageID) + sizeof(uint64_t)) + e->used;
+}
+
+// take a result out of the cache (it is freed unless pinned)
+
+static void unlinkResult(QCache c, QResult e)
+{
+	QResult *p = &c->slots[e->hash & (c->nslots - 1)];
+	while (*p != e) p = &(*p)->next;
+	*p = e->next;
+	if (e->newer != NULL) e->newer->older = e->older;
+	else c->newest = e->older;
+	if (e->older != NULL) e->older->newer = e->newer;
+	else c->oldest = e->newer;
+	c->used -= e->size;
+	c->nentries--;
+	e->cached = FALSE;
+	e->refs++;
+	qresultRelease(e);
+}
+
+// double the size of the hash table
+
+static void growTable(QCache c)
+{
+	Count n = c->nslots * 2;
+	QResult *slots = calloc(n, sizeof(QResult));
+	assert(slots != NULL);
+	for (Count i = 0; i < c->nslots; i++) {
+		QResult e = c->slots[i];
+		while (e != NULL) {
+			QResult next = e->next;
+			Count k = e->hash & (n - 1);
+			e->next = slots[k];
+			slots[k] = e;
+			e = next;
+		}
+	}
+	free(c->slots);
+	c->slots = slots;
+	c->nslots = n;
+}
@@ -0,0 +1,28 @@
+// qcache.h ... interface to the query result cache
+// part of Multi-attribute Linear-hashed Files
+// See qcache.c for details of QCache type and functions
+
+#ifndef QCACHE_H
+#define QCACHE_H 1
+
+typedef struct QCacheRep *QCache;
+typedef struct QResultRep *QResult;
+
+#include "defs.h"
+#include "reln.h"
+
+QCache newQCache(size_t budget);
+void freeQCache(QCache c);
+QResult qcacheLookup(QCache c, Reln r, char *key);
+void qcacheInsert(QCache c, QResult e);
+void qcacheStats(QCache c);
+
+// building and reading results
+QResult newQResult(QCache c, char *key);
+Status qresultAddBucket(QResult e, PageID bid, uint64_t version);
+Status qresultAddTuple(QResult e, char *t, Count len);
+uint64_t qresultNTuples(QResult e);
+char *qresultTuple(QResult e, size_t *pos);
+void qresultRelease(QResult e);
+
+#endif
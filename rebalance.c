@@ -0,0 +1,64 @@
+// rebalance.c ... propose (and apply) a better choice vector
+// part of Multi-attribute Linear-hashed Files
+// Usage:  ./rebalance  [-s Sample]  [-i InputFile]  [-r]  RelName
+//
+// Samples the relation (or, with -i, the tuples in InputFile, such
+// as data about to be inserted), and reports how evenly its tuples
+// are, and would be, spread over its buckets (see cvadvise.c)
+// With -r, the relation is then rebuilt with the proposed choice
+// vector; nothing else may use it meanwhile
+
+#include "defs.h"
+#include "reln.h"
+#include "cvadvise.h"
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG];
+	char opts[MAXERRMSG] = "";
+	char cv[CHVECLEN];
+	Bool rebuild = FALSE;
+	int  i;
+
+	for (i = 1; i < argc - 1; i++) {
+		if (strcmp(argv[i], "-r") == 0)
+			rebuild = TRUE;
+		else if ((strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-i") == 0)
+		         && i + 1 < argc - 1
+		         && strlen(opts) + strlen(argv[i+1]) + 8 < MAXERRMSG) {
+			sprintf(opts + strlen(opts), "%s%s=%s", opts[0] == '\0' ? "" : ",",
+			        argv[i][1] == 's' ? "sample" : "input", argv[i+1]);
+			i++;
+		}
+		else
+			break;
+	}
+	if (i != argc - 1) {
+		sprintf(err, "Usage: %s [-s Sample] [-i InputFile] [-r] RelName", argv[0]);
+		fatal(err);
+	}
+	char *name = argv[i];
+	if (!existsRelation(name)) {
+		sprintf(err, "No such relation: %s", name);
+		fatal(err);
+	}
+
+	Reln r = openRelation(name, "r");
+	if (r == NULL) {
+		sprintf(err, "Can't open relation: %s", name);
+		fatal(err);
+	}
+	if (adviseChVec(r, opts, cv, stdout) != OK) {
+		closeRelation(r);
+		return 1;
+	}
+	if (rebuild) {
+		if (rebuildRelation(r, name, cv) != OK) {
+			closeRelation(r);
+			return 1;
+		}
+		printf("Rebuilt %s with the proposed choice vector\n", name);
+	}
+	closeRelation(r);
+	return 0;
+}
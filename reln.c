@@ -6,6 +6,8 @@
 
 #include <math.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
 
 
 #include "defs.h"
@@ -15,40 +17,137 @@
 #include "chvec.h"
 #include "bits.h"
 #include "hash.h"
+#include "pageio.h"
+#include "qcache.h"
+#include "arena.h"
+#include "delim.h"
 
-#define HEADERSIZE (3*sizeof(Count)+sizeof(Offset))
+// .info files start with this magic number and a format version;
+// the version changes whenever the .info or page format does
+#define INFOMAGIC   0x53464c4dU   // "MLFS"
+#define INFOVERSION 5
+
+// in shared mode, bucket b is guarded by latch b % NLATCHES
+// (a set of latches is a bit mask, so at most 64)
+#define NLATCHES    64
+
+// addTuplesParallel() threads take this many tuples at a time
+#define PARCHUNK    256
+
+// after deletes, buckets are merged while the relation holds fewer
+// than MINLOAD tuples per Pcap (see claimTuples()) per bucket
+#define MINLOAD     0.5
+
+// arena chunk size for addTuplesToRelation() (it is reset after
+// each run of tuples, so usually only the first chunk is needed)
+#define INSCHUNK    (64*PAGESIZE)
 
 
 /* NEW FUNCS*/
 
-static void flushToBuck(Reln r, PageID bid, Page buf);
+static Status addTuple(Reln r, Page p, Tuple t);
+static void rewriteBucket(Reln r, Count nchain, PageID *pids, Page *chain, Count nfill, Page *fill);
 static void lh_split(Reln r);
+static void lh_merge(Reln r);
+static Count readChain(Reln r, PageID bid, PageID **pids, Page **pages);
+static Count repackPages(Reln r, Count n, Page *pages, Bool (*drop)(void *, Tuple), void *arg, Page **fill, uint64_t *ndropped);
+static void freeOvflowPages(Reln r, Count n, PageID *pids, Page *pages);
+static Count splitEvery(Reln r);
+static Bool claimTuples(Reln r, Count *n);
+static void releaseTuples(Reln r, Count n);
+static void splitNext(Reln r);
+static PageID lockBucketOf(Reln r, Bits h);
+static PageID newOvflowPage(Reln r);
+static PageID bucketOf(Reln r, Bits h);
+static Count findPage(Count n, PageID *pids, PageID pid);
+static Count insertRun(Reln r, Tuple *ts, Count n, Arena mem);
+static Status parseRelnOpts(Reln r, char *opts, Bool create);
+static Status parseSigAttrs(Reln r, char *val);
+static void sigsString(Reln r, char *buf);
+static uint64_t latchBit(PageID b);
+static void lockBuckets(Reln r, uint64_t latches, Bool write);
+static void unlockBuckets(Reln r, uint64_t latches);
+static void metaLock(Reln r);
+static void metaUnlock(Reln r);
+static PageID insertIntoBucket(Reln r, PageID p, Tuple t);
+static Count bucketFamily(Reln r, RelnSnapshot *snap, PageID bid, PageID **fam, uint64_t *latches);
+static void bumpBucket(Reln r, PageID b);
 
 
 
 struct RelnRep {
 	Count  nattrs; // number of attributes
 	Count  depth;  // depth of main data file
-	Offset sp;     // split pointer
-    Count  npages; // number of main data pages
-    Count  ntups;  // total number of tuples
+	PageID sp;     // split pointer
+	PageID npages; // number of main data pages
+	uint64_t ntups; // total number of tuples
+	PageID freeOv; // first free overflow page (NO_PAGE if none)
 	ChVec  cv;     // choice vector
+	Byte   hashfn; // hash function family (HASH_ANY, ...)
+	Byte   layout; // page layout (PAGE_ROW, PAGE_PAX, PAGE_DICT)
+	Byte   nzones; // #attributes with per-page zone maps (0 = none)
+	Byte   nsigs;  // #attributes with per-page n-gram signatures (0 = none)
+	Byte   sigAttrs[MAXSIGS]; // those attributes (0-based, ascending)
+	AttrType types[MAXATTRS]; // attribute types (PAGE_TYPED only)
 	char   mode;   // open for read/write
 	FILE  *info;   // handle on info file
 	FILE  *data;   // handle on data file
 	FILE  *ovflow; // handle on ovflow file
+	PageIO io;     // page I/O backend for data/ovflow files
+	// shared mode: concurrent readers and writers (threads)
+	Bool   shared;  // open with concurrent=on
+	uint64_t epoch; // #splits since the relation was opened
+	pthread_mutex_t meta;  // guards depth, sp, npages, ntups, epoch
+	pthread_mutex_t split; // one split at a time
+	pthread_mutex_t grow;  // one new overflow page at a time
+	pthread_rwlock_t latch[NLATCHES];  // bucket latches
+	// query result cache (cache=SIZE; NULL if off)
+	QCache cache;
+	uint64_t *versions; // bumped by every change to bucket b
+	PageID nversions;
+	// arena allocations by scans and inserts (see countAllocs())
+	uint64_t nallocs;
+	uint64_t nmallocs;
 };
 
 // create a new relation (three files)
 
 Status newRelation(char *name, Count nattrs, Count npages, Count d, char *cv)
+{
+	return newRelationOpts(name, nattrs, npages, d, cv, "");
+}
+
+// create a new relation with creation-time options
+// opts is a comma-separated list of key=value settings
+//   hash=any|wy   hash function family (default: any)
+//   layout=row|pax   page layout (default: row)
+//   compress=none|dict   per-page dictionary compression (default: none);
+//                        stored as the PAGE_DICT layout, so not with pax
+//   zonemap=on|off   keep the min/max numeric value of each attribute
+//                    (the first MAXZONES) in every page (default: off)
+//   ngram=on|off|A[:B...]   keep a trigram signature of attributes
+//                    A, B, ... (1-based; "on" = the first MAXSIGS) in
+//                    every page, to speed up '%' pattern queries
+//                    (default: off)
+//   schema=T1[:T2...]   attribute types (see schema.c), one for each
+//                    attribute; tuples are then stored in binary
+//                    form (the PAGE_TYPED layout), so not with pax
+//                    or dict (default: none; all values are text)
+
+Status newRelationOpts(char *name, Count nattrs, Count npages, Count d, char *cv, char *opts)
 {
     char fname[MAXFILENAME];
 	Reln r = malloc(sizeof(struct RelnRep));
+	assert(r != NULL);
 	r->nattrs = nattrs; r->depth = d; r->sp = 0;
 	r->npages = npages; r->ntups = 0; r->mode = 'w';
-	assert(r != NULL);
-	if (parseChVec(r, cv, r->cv) != OK) return ~OK;
+	r->freeOv = NO_PAGE;
+	r->hashfn = HASH_ANY; r->layout = PAGE_ROW; r->io = NULL;
+	r->cache = NULL; r->versions = NULL;
+	r->nzones = 0; r->nsigs = 0;
+	r->shared = FALSE; r->epoch = 0;
+	if (parseChVec(r, cv, r->cv) != OK) { free(r); return ~OK; }
+	if (parseRelnOpts(r, opts, TRUE) != OK) { free(r); return ~OK; }
 	sprintf(fname,"%s.info",name);
 	r->info = fopen(fname,"w");
 	assert(r->info != NULL);
@@ -64,6 +163,184 @@ Status newRelation(char *name, Count nattrs, Count npages, Count d, char *cv)
 	return 0;
 }
 
+// parse the value of the ngram= option into r->nsigs/sigAttrs
+// "off", "on" (the first MAXSIGS attributes), or a ':'-separated
+// list of distinct 1-based attribute numbers (at most MAXSIGS,
+// and among the first 256, since pages store them as bytes)
+
+static Status parseSigAttrs(Reln r, char *val)
+{
+	r->nsigs = 0;
+	if (strcmp(val, "off") == 0) return OK;
+	if (strcmp(val, "on") == 0) {
+		while (r->nsigs < MAXSIGS && r->nsigs < r->nattrs) {
+			r->sigAttrs[r->nsigs] = r->nsigs;
+			r->nsigs++;
+		}
+		return OK;
+	}
+	char *c = val;
+	for (;;) {
+		char *end;
+		long a = strtol(c, &end, 10);
+		if (end == c || a < 1 || a > r->nattrs || a > 256
+		    || r->nsigs == MAXSIGS)
+			return ~OK;
+		// keep the list sorted; it is short
+		Count i = r->nsigs++;
+		while (i > 0 && r->sigAttrs[i-1] >= a-1) {
+			if (r->sigAttrs[i-1] == a-1) return ~OK;
+			r->sigAttrs[i] = r->sigAttrs[i-1];
+			i--;
+		}
+		r->sigAttrs[i] = a-1;
+		if (*end == '\0') return OK;
+		if (*end != ':') return ~OK;
+		c = end+1;
+	}
+}
+
+// parse the options string given to newRelationOpts() (create)
+//   or openRelationOpts() (!create)
+// unknown keys or values are reported and rejected
+
+static Status parseRelnOpts(Reln r, char *opts, Bool create)
+{
+	int io = IO_PREAD;
+	Bool direct = FALSE, dict = FALSE, shared = FALSE, typed = FALSE;
+	size_t cache = 0;
+	char buf[MAXRELOPTS];
+	char *c, *key, *val, *save;
+	if (opts == NULL) return OK;
+	if (strlen(opts) >= MAXRELOPTS) {
+		printf("Relation options too long\n");
+		return ~OK;
+	}
+	strcpy(buf, opts);
+	for (c = strtok_r(buf, ",", &save); c != NULL; c = strtok_r(NULL, ",", &save)) {
+		key = c;
+		val = strchr(c, '=');
+		if (val == NULL) {
+			printf("Invalid relation option: %s\n", c);
+			return ~OK;
+		}
+		*val++ = '\0';
+		if (create && strcmp(key, "hash") == 0) {
+			int fn = hashFnByName(val);
+			if (fn < 0) {
+				printf("Unknown hash function: %s\n", val);
+				return ~OK;
+			}
+			r->hashfn = fn;
+		}
+		else if (create && strcmp(key, "layout") == 0) {
+			int layout = layoutByName(val);
+			if (layout < 0) {
+				printf("Unknown page layout: %s\n", val);
+				return ~OK;
+			}
+			if (layout != PAGE_ROW && r->nattrs > MAXATTRS) {
+				printf("Too many attributes for %s layout\n", val);
+				return ~OK;
+			}
+			r->layout = layout;
+		}
+		else if (create && strcmp(key, "compress") == 0) {
+			if (strcmp(val, "dict") != 0 && strcmp(val, "none") != 0) {
+				printf("Unknown compression: %s\n", val);
+				return ~OK;
+			}
+			dict = (strcmp(val, "dict") == 0);
+		}
+		else if (create && strcmp(key, "zonemap") == 0) {
+			if (strcmp(val, "on") != 0 && strcmp(val, "off") != 0) {
+				printf("Invalid zonemap option: %s\n", val);
+				return ~OK;
+			}
+			r->nzones = (strcmp(val, "off") == 0) ? 0
+			          : (r->nattrs < MAXZONES) ? r->nattrs : MAXZONES;
+		}
+		else if (create && strcmp(key, "ngram") == 0) {
+			if (parseSigAttrs(r, val) != OK) {
+				printf("Invalid ngram option: %s\n", val);
+				return ~OK;
+			}
+		}
+		else if (create && strcmp(key, "schema") == 0) {
+			if (parseSchema(val, r->nattrs, r->types) != OK) {
+				printf("Invalid schema: %s\n", val);
+				return ~OK;
+			}
+			typed = TRUE;
+		}
+		else if (!create && strcmp(key, "io") == 0) {
+			io = pageIOByName(val);
+			if (io < 0) {
+				printf("Unknown I/O backend: %s\n", val);
+				return ~OK;
+			}
+		}
+		else if (!create && strcmp(key, "direct") == 0) {
+			if (strcmp(val, "on") != 0 && strcmp(val, "off") != 0) {
+				printf("Invalid direct option: %s\n", val);
+				return ~OK;
+			}
+			direct = (strcmp(val, "on") == 0);
+		}
+		else if (!create && strcmp(key, "concurrent") == 0) {
+			if (strcmp(val, "on") != 0 && strcmp(val, "off") != 0) {
+				printf("Invalid concurrent option: %s\n", val);
+				return ~OK;
+			}
+			shared = (strcmp(val, "on") == 0);
+		}
+		else if (!create && strcmp(key, "cache") == 0) {
+			if (parseSize(val, &cache) != 0) {
+				printf("Invalid cache size: %s\n", val);
+				return ~OK;
+			}
+		}
+		else {
+			printf("Unknown relation option: %s\n", key);
+			return ~OK;
+		}
+	}
+	if (dict) {
+		if (r->layout == PAGE_PAX) {
+			printf("compress=dict can't be used with layout=pax\n");
+			return ~OK;
+		}
+		if (r->nattrs > MAXATTRS) {
+			printf("Too many attributes for dict compression\n");
+			return ~OK;
+		}
+		r->layout = PAGE_DICT;
+	}
+	if (create && r->layout == PAGE_TYPED && !typed) {
+		printf("layout=typed needs a schema\n");
+		return ~OK;
+	}
+	if (typed) {
+		if (r->layout != PAGE_ROW && r->layout != PAGE_TYPED) {
+			printf("schema can't be used with layout=pax or compress=dict\n");
+			return ~OK;
+		}
+		r->layout = PAGE_TYPED;
+	}
+	if (shared && cache > 0) {
+		printf("cache can't be used with concurrent=on\n");
+		return ~OK;
+	}
+	if (!create) {
+		r->io = newPageIO(io, direct);
+		r->shared = shared;
+		r->cache = (cache > 0) ? newQCache(cache) : NULL;
+		r->versions = NULL;
+		r->nversions = 0;
+	}
+	return OK;
+}
+
 // check whether a relation already exists
 
 Bool existsRelation(char *name)
@@ -83,10 +360,27 @@ Bool existsRelation(char *name)
 // open files, reads information from rel.info
 
 Reln openRelation(char *name, char *mode)
+{
+	return openRelationOpts(name, mode, "");
+}
+
+// open a relation with run-time options
+// opts is a comma-separated list of key=value settings
+//   io=pread|uring   page I/O backend (default: pread)
+//   direct=on|off    use O_DIRECT for page I/O (default: off)
+//   concurrent=on|off   allow several threads to insert and select
+//                       through this handle at once (default: off)
+//   cache=SIZE       keep the results of recent queries, in up to
+//                    SIZE bytes (suffix k or m; default: 0 = off);
+//                    not with concurrent=on
+// returns NULL if the options are invalid
+
+Reln openRelationOpts(char *name, char *mode, char *opts)
 {
 	Reln r;
 	r = malloc(sizeof(struct RelnRep));
 	assert(r != NULL);
+	if (parseRelnOpts(r, opts, FALSE) != OK) { free(r); return NULL; }
 	char fname[MAXFILENAME];
 	sprintf(fname,"%s.info",name);
 	r->info = fopen(fname,mode);
@@ -97,12 +391,49 @@ Reln openRelation(char *name, char *mode)
 	sprintf(fname,"%s.ovflow",name);
 	r->ovflow = fopen(fname,mode);
 	assert(r->ovflow != NULL);
-	// Naughty: assumes Count and Offset are the same size
-	int n = fread(r, sizeof(Count), 5, r->info);
+	// read core relation info (magic,version,#attr,d,sp,#pages,#tuples)
+	uint32_t magic = 0, version = 0;
+	int n = fread(&magic, sizeof(magic), 1, r->info);
+	n += fread(&version, sizeof(version), 1, r->info);
+	if (n != 2 || magic != INFOMAGIC || version != INFOVERSION)
+		fatal("Relation is in an old file format; re-create and reload it");
+	n = fread(&r->nattrs, sizeof(Count), 1, r->info);
+	n += fread(&r->depth, sizeof(Count), 1, r->info);
+	n += fread(&r->sp, sizeof(PageID), 1, r->info);
+	n += fread(&r->npages, sizeof(PageID), 1, r->info);
+	n += fread(&r->ntups, sizeof(uint64_t), 1, r->info);
 	assert(n == 5);
 	n = fread(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
 	assert(n == MAXCHVEC);
+	n = fread(&r->hashfn, sizeof(Byte), 1, r->info);
+	assert(n == 1 && r->hashfn < NHASHFNS);
+	n = fread(&r->layout, sizeof(Byte), 1, r->info);
+	assert(n == 1 && r->layout < NLAYOUTS);
+	n = fread(&r->nzones, sizeof(Byte), 1, r->info);
+	assert(n == 1 && r->nzones <= MAXZONES);
+	n = fread(&r->nsigs, sizeof(Byte), 1, r->info);
+	assert(n == 1 && r->nsigs <= MAXSIGS);
+	n = fread(r->sigAttrs, sizeof(Byte), r->nsigs, r->info);
+	assert(n == r->nsigs);
+	n = fread(&r->freeOv, sizeof(PageID), 1, r->info);
+	assert(n == 1);
+	if (r->layout == PAGE_TYPED) {
+		assert(r->nattrs <= MAXATTRS);
+		n = fread(r->types, sizeof(AttrType), r->nattrs, r->info);
+		assert(n == r->nattrs);
+	}
+	pageIOAttach(r->io, r->data);
+	pageIOAttach(r->io, r->ovflow);
 	r->mode = (mode[0] == 'w' || mode[1] =='+') ? 'w' : 'r';
+	r->epoch = 0;
+	r->nallocs = r->nmallocs = 0;
+	if (r->shared) {
+		pthread_mutex_init(&r->meta, NULL);
+		pthread_mutex_init(&r->split, NULL);
+		pthread_mutex_init(&r->grow, NULL);
+		for (int i = 0; i < NLATCHES; i++)
+			pthread_rwlock_init(&r->latch[i], NULL);
+	}
 	return r;
 }
 
@@ -112,15 +443,47 @@ Reln openRelation(char *name, char *mode)
 void closeRelation(Reln r)
 {
 	// make sure updated global data is put in info
-	// Naughty: assumes Count and Offset are the same size
 	if (r->mode == 'w') {
 		fseek(r->info, 0, SEEK_SET);
-		// write out core relation info (#attr,#pages,d,sp)
-		int n = fwrite(r, sizeof(Count), 5, r->info);
-		assert(n == 5);
+		// write out core relation info (magic,version,#attr,d,sp,#pages,#tuples)
+		uint32_t magic = INFOMAGIC, version = INFOVERSION;
+		int n = fwrite(&magic, sizeof(magic), 1, r->info);
+		n += fwrite(&version, sizeof(version), 1, r->info);
+		n += fwrite(&r->nattrs, sizeof(Count), 1, r->info);
+		n += fwrite(&r->depth, sizeof(Count), 1, r->info);
+		n += fwrite(&r->sp, sizeof(PageID), 1, r->info);
+		n += fwrite(&r->npages, sizeof(PageID), 1, r->info);
+		n += fwrite(&r->ntups, sizeof(uint64_t), 1, r->info);
+		assert(n == 7);
 		// write out choice vector
 		n = fwrite(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
 		assert(n == MAXCHVEC);
+		// write out hash function family, page layout,
+		// zone maps and n-gram signatures
+		n = fwrite(&r->hashfn, sizeof(Byte), 1, r->info);
+		n += fwrite(&r->layout, sizeof(Byte), 1, r->info);
+		n += fwrite(&r->nzones, sizeof(Byte), 1, r->info);
+		n += fwrite(&r->nsigs, sizeof(Byte), 1, r->info);
+		n += fwrite(r->sigAttrs, sizeof(Byte), r->nsigs, r->info);
+		assert(n == 4 + r->nsigs);
+		// write out the free list of overflow pages
+		n = fwrite(&r->freeOv, sizeof(PageID), 1, r->info);
+		assert(n == 1);
+		// write out the attribute types (typed relations)
+		if (r->layout == PAGE_TYPED) {
+			n = fwrite(r->types, sizeof(AttrType), r->nattrs, r->info);
+			assert(n == r->nattrs);
+		}
+	}
+	if (r->io != NULL) closePageIO(r->io);
+	if (r->cache != NULL) freeQCache(r->cache);
+	free(r->versions);
+	if (r->shared) {
+		pthread_mutex_destroy(&r->meta);
+		pthread_mutex_destroy(&r->split);
+		pthread_mutex_destroy(&r->grow);
+		for (int i = 0; i < NLATCHES; i++)
+			pthread_rwlock_destroy(&r->latch[i]);
 	}
 	fclose(r->info);
 	fclose(r->data);
@@ -131,65 +494,94 @@ void closeRelation(Reln r)
 
 
 
+// add a tuple to a page of this relation
+// an empty page takes on the relation's page layout,
+// zone map and signatures first
+
+static Status addTuple(Reln r, Page p, Tuple t)
+{
+	if (pageNTuples(p) == 0 &&
+	    (pageLayout(p) != r->layout || pageZones(p) != r->nzones
+	     || pageSigs(p) != r->nsigs)) {
+		pageSetZones(p, r->nzones);
+		pageSetSigs(p, r->nsigs, r->sigAttrs);
+		if (r->layout == PAGE_TYPED)
+			pageSetTypes(p, r->nattrs, r->types);
+		else
+			pageSetLayout(p, r->layout, r->nattrs);
+	}
+	return addToPage(p, t);
+}
+
+
+
 /******************************************************
 NEW FUNC 
-// flush a temporary page AS A WHOLE to an existing bucket
-// for linear hash, temp page will be full of tuples
-// to the appropriate position in bucket (bid)
+// write a list of (full) pages into a bucket whose chain
+// of pages (pids/chain) has already been read into memory
+// - chain pages are reused in order for the fill pages
+// - left-over overflow pages are emptied and put on the free list
+// - extra overflow pages are added at the end of the chain if needed
+// - all the bucket's pages are written in one batch per file
+// all page buffers (chain and fill) are released
 *******************************************************/
-static void flushToBuck(Reln r, PageID bid, Page buf) {
-
-	//first look for primary page 
-	//and check if it is empty or not
-	//if empty: flush to primary data file
-	//if not, flush to the next empty overflow if any
-	// or flush to the end of the overflow chain if there is no empty overflow (have to record new overflow info)
-	Page 	p = getPage(r->data, bid);
-	PageID 	pid = bid; 
-	PageID  ovf;
-	Bool 	isOvf = FALSE;
-	Bool 	done = FALSE;
-
-
-	while (done == FALSE) {
-		// if encounter an empty page in the bucket, flush
-		if (p->ntuples == 0) {
-			buf->ovflow = p->ovflow;
-			if (isOvf == FALSE) 
-				putPage(r->data, pid, buf);
-			else 
-				putPage(r->ovflow, pid, buf);
-			done = TRUE;
-			free(p);
-
+static void rewriteBucket(Reln r, Count nchain, PageID *pids, Page *chain, Count nfill, Page *fill) {
+
+	assert(nfill > 0);
+	Count 	nout = (nfill > nchain) ? nfill : nchain;
+	PageID  outPid[nout];
+	Page 	out[nout];
+
+	for (Count k = 0; k < nout; k++) {
+		out[k] = (k < nfill) ? fill[k] : newPage();
+		if (k < nchain) {
+			// reuse chain page
+			outPid[k] = pids[k];
+			free(chain[k]);
 		} else {
-		// move to next page (overflow) in bucket
-			ovf = pageOvflow(p);
-			if (ovf == NO_PAGE) 
-				break;
-			else {
-				free(p);
-				p = getPage(r->ovflow, ovf);
-				pid = ovf;
-				isOvf = TRUE;
-			}
+			// chain ran out: new overflow page at end of chain
+			outPid[k] = newOvflowPage(r);
 		}
 	}
+	for (Count k = 0; k < nfill; k++)
+		out[k]->ovflow = (k + 1 < nfill) ? outPid[k+1] : NO_PAGE;
+
+	// primary page is in the data file, the rest in ovflow
+	writePages(r->io, r->data, 1, outPid, out);
+	writePages(r->io, r->ovflow, nfill - 1, outPid + 1, out + 1);
+	if (nout > nfill)
+		freeOvflowPages(r, nout - nfill, outPid + nfill, out + nfill);
+}
+
+
+
+// read the chain of pages in bucket bid
+// (each page gives the id of the next one, so one at a time)
+// sets *pids and *pages to new arrays; returns the chain's length
 
-	// if after the loop done == FALSE
-	// means reaching the end of bucket without flushing
-	// have to create new overflow 
-	// record the overflow information in previous page
-	if (done == FALSE) {
-		ovf = addPage(r->ovflow);
-		p->ovflow = ovf;
-		if (isOvf == FALSE) 
-			putPage(r->data, pid, p);
-		else 
-			putPage(r->ovflow, pid, p);
-		putPage(r->ovflow, ovf, buf);
+static Count readChain(Reln r, PageID bid, PageID **pids, Page **pages)
+{
+	Count	nchain = 0, maxchain = 8;
+	PageID	*cpids = malloc(maxchain * sizeof(PageID));
+	Page	*chain = malloc(maxchain * sizeof(Page));
+	assert(cpids != NULL && chain != NULL);
+	cpids[0] = bid;
+	chain[0] = getPage(r->data, bid);
+	nchain = 1;
+	while (pageOvflow(chain[nchain-1]) != NO_PAGE) {
+		if (nchain == maxchain) {
+			maxchain *= 2;
+			cpids = realloc(cpids, maxchain * sizeof(PageID));
+			chain = realloc(chain, maxchain * sizeof(Page));
+			assert(cpids != NULL && chain != NULL);
+		}
+		cpids[nchain] = pageOvflow(chain[nchain-1]);
+		chain[nchain] = getPage(r->ovflow, cpids[nchain]);
+		nchain++;
 	}
-	
+	*pids = cpids;
+	*pages = chain;
+	return nchain;
 }
 
 
@@ -198,122 +590,314 @@ static void flushToBuck(Reln r, PageID bid, Page buf) {
 NEW FUNC - LINEAR HASHING
  - splitting page 
  - relocate tuples
+ - the split bucket's whole chain is read first, its tuples
+   are repacked into "stay" and "move" pages in memory, and
+   both buckets are then written out in batches
 ***************************/
 
 static void lh_split(Reln r) {
 
 
 	//create new splitted page/bucket
+	//(npages is only updated once the split is done)
 	PageID 		newBid = addPage(r->data);
-	//have to manually update number of primary pages
-	r->npages += 1;
+	assert(newBid == r->npages);
 
 
-	//for debug
-	// printf("    create a new primary page/bucket id = %u \n", newBid);
-	// printf("    now relation have %u pages \n", r->npages);
-
-	//then, check and redistribute tuples in bucket pointed to by split pointer (if any)
-
-	char	tup[MAXTUPLEN];
-	Bool 	finished = FALSE;
-	Bool 	isOvf = FALSE;
-	PageID	curPid = r->sp;
-	PageID  ovf;
-	Page	move = newPage();
-	Page 	stay = newPage();
-	Page 	p;
-	Bits    tupHash;
-	Status 	try;
-
-	// parsing through all pages in the split bucket
-	while (finished != TRUE) {
-		// get the next page
-		if (isOvf != TRUE) 
-			p = getPage(r->data, curPid);
-		else
-			p = getPage(r->ovflow, curPid);
+	// read the chain of pages in bucket pointed to by split pointer
+	PageID	*cpids;
+	Page	*chain;
+	Count	nchain = readChain(r, r->sp, &cpids, &chain);
 
-		char* c = p->data;
-		char* start = p->data;
+	// then redistribute tuples into "stay" and "move" pages
+	// (the stay tuples never need more pages than the chain had)
+	Count	nstay = 0, nmove = 0;
+	Page	*stay = malloc((nchain + 1) * sizeof(Page));
+	Page	*move = malloc((nchain + 1) * sizeof(Page));
+	assert(stay != NULL && move != NULL);
+	stay[nstay++] = newPage();
+	move[nmove++] = newPage();
 
-		// check all tup one by one
-		while (c < p->data + p->free) {
-			if (*c == '\0') {
-				memcpy(tup, start, sizeof(char)*(c - start + 1));
-				assert(tup[c-start] == '\0');
-				//hash tup and get (depth + 1) lower bit
-				//then place tup in either stay or move buffer
-				//flush buffer to appropriate bucket when full
-				tupHash = tupleHash(r, tup);
-				if (bitIsSet(tupHash, r->depth) == 0) {
-					try = addToPage(stay, tup);
-					// if the buffer for "stay" tuples is full
-					if (try != OK) {
-						flushToBuck(r, r->sp, stay);
-						stay = newPage();
-						addToPage(stay, tup);
-					}
+	for (Count i = 0; i < nchain; i++) {
+		PageScan	scan;
+		char		buf[MAXTUPLEN];
+		Tuple		tup;
 
-				} else {
-					try = addToPage(move, tup);
-					// if the buffer for moved tuples is full
-					if (try != OK) {
-						flushToBuck(r, newBid, move);  //moved will also get freed here
-						move = newPage();
-						addToPage(move, tup);
-					}
+		// check all tup one by one
+		startPageScan(chain[i], &scan);
+		while ((tup = nextPageTuple(chain[i], &scan, buf)) != NULL) {
+			//hash tup and get (depth + 1) lower bit
+			//then place tup in either stay or move pages
+			Bits	tupHash = tupleHash(r, tup);
+			if (bitIsSet(tupHash, r->depth) == 0) {
+				if (addTuple(r, stay[nstay-1], tup) != OK) {
+					stay[nstay++] = newPage();
+					addTuple(r, stay[nstay-1], tup);
+				}
+			} else {
+				if (addTuple(r, move[nmove-1], tup) != OK) {
+					move[nmove++] = newPage();
+					addTuple(r, move[nmove-1], tup);
 				}
-				
-				start = c + 1;
 			}
-			c ++;
 		}
-		
+	}
 
+	// write back both buckets
+	// new bucket's chain is just its (empty) primary page
+	rewriteBucket(r, nchain, cpids, chain, nstay, stay);
+	Page	newPrimary = newPage();
+	rewriteBucket(r, 1, &newBid, &newPrimary, nmove, move);
 
-		// get the next overflow id
-		ovf = pageOvflow(p);
+	free(cpids); free(chain);
+	free(stay); free(move);
 
-		// "empty" the page and flush back to old spot in split bucket 
-		// retain the overflow information
-		// (will be refilled later when stay buffer is full)
+	//printf("reln.c lh_split finishing linear split\n\n");  // for debug
 
-		p->free = 0;
-		p->ntuples = 0;
-		int dataSize = PAGESIZE - 2*sizeof(Offset) - sizeof(Count);
-		memset(p->data, 0, dataSize);
-		
-		if (isOvf != TRUE) 
-			putPage(r->data, curPid, p);
-		else
-			putPage(r->ovflow, curPid, p);
+}
 
-		
-		if (ovf == NO_PAGE) 
-			finished = TRUE; 
-		else {
-			curPid = ovf;
-			isOvf = TRUE;
+
+
+/**************************
+NEW FUNC - LINEAR HASHING
+ - merging buckets (the reverse of lh_split)
+ - the split pointer moves back one bucket (and depth goes
+   down when it passes 0); the last bucket's tuples go back
+   into the bucket it was split from, which is now at sp
+ - the last bucket's overflow pages go on the free list, and
+   its primary page is cut off the end of the data file
+***************************/
+
+static void lh_merge(Reln r) {
+
+	assert(r->npages > 1);
+	if (r->sp == 0) {
+		r->depth -= 1;
+		r->sp = (PageID)1 << r->depth;
+	}
+	r->sp -= 1;
+	PageID		last = r->npages - 1;
+	assert(last == r->sp + ((PageID)1 << r->depth));
+
+	// read both chains, and repack all their tuples
+	PageID	*bpids, *lpids;
+	Page	*bchain, *lchain;
+	Count	nb = readChain(r, r->sp, &bpids, &bchain);
+	Count	nl = readChain(r, last, &lpids, &lchain);
+	Page	all[nb + nl];
+	memcpy(all, bchain, nb * sizeof(Page));
+	memcpy(all + nb, lchain, nl * sizeof(Page));
+	Page	*fill;
+	uint64_t ndropped;
+	Count	nfill = repackPages(r, nb + nl, all, NULL, NULL, &fill, &ndropped);
+
+	// last bucket's pages are no longer needed
+	free(lchain[0]);
+	for (Count i = 1; i < nl; i++) {
+		free(lchain[i]);
+		lchain[i] = newPage();
+	}
+	freeOvflowPages(r, nl - 1, lpids + 1, lchain + 1);
+	rewriteBucket(r, nb, bpids, bchain, nfill, fill);
+
+	r->npages -= 1;
+	if (ftruncate(fileno(r->data), (off_t)r->npages * PAGESIZE) != 0)
+		fatal("Can't shrink data file");
+
+	free(bpids); free(bchain);
+	free(lpids); free(lchain);
+	free(fill);
+}
+
+
+
+// copy the tuples in n pages into new pages (at least one),
+// leaving out those for which drop(arg, t) is TRUE (drop may be NULL)
+// the old pages are not released; sets *fill to a new array of
+// the new pages and *ndropped to #tuples left out; returns #new pages
+
+static Count repackPages(Reln r, Count n, Page *pages, Bool (*drop)(void *, Tuple), void *arg, Page **fill, uint64_t *ndropped)
+{
+	Count	nfill = 0, maxfill = n + 1;
+	Page	*out = malloc(maxfill * sizeof(Page));
+	assert(out != NULL);
+	out[nfill++] = newPage();
+	*ndropped = 0;
+
+	for (Count i = 0; i < n; i++) {
+		PageScan	scan;
+		char		buf[MAXTUPLEN];
+		Tuple		tup;
+
+		startPageScan(pages[i], &scan);
+		while ((tup = nextPageTuple(pages[i], &scan, buf)) != NULL) {
+			if (drop != NULL && drop(arg, tup)) {
+				(*ndropped)++;
+				continue;
+			}
+			if (addTuple(r, out[nfill-1], tup) == OK) continue;
+			if (nfill == maxfill) {
+				maxfill *= 2;
+				out = realloc(out, maxfill * sizeof(Page));
+				assert(out != NULL);
+			}
+			out[nfill++] = newPage();
+			addTuple(r, out[nfill-1], tup);
 		}
-			
 	}
-	
-	// after finish parsing
-	//if there is any remaining tup in "move" and "stay" buffers-> flush it out
-	
-	if (stay != NULL) {
-		if (stay->ntuples > 0) flushToBuck(r, r->sp, stay); else free(stay);
+	*fill = out;
+	return nfill;
+}
+
+
+
+// #tuples inserted between splits
+
+static Count splitEvery(Reln r)
+{
+	Count Pcap = floor(102.4/r->nattrs);
+	assert(Pcap > 0);
+	return Pcap;
+}
+
+// claim places in the relation for up to *n more tuples,
+// but no more than can go in before the next split is due;
+// sets *n to the number claimed
+// returns TRUE if the relation should be split before they go in
+// (every Pcap'th tuple triggers a split)
+
+static Bool claimTuples(Reln r, Count *n)
+{
+	Count Pcap = splitEvery(r);
+
+	metaLock(r);
+	uint64_t t = r->ntups;
+	Count run = Pcap - t % Pcap;
+	if (*n > run) *n = run;
+	r->ntups += *n;
+	metaUnlock(r);
+	return (t > 0 && t % Pcap == 0);
+}
+
+// give back places claimed for tuples that could not be inserted
+
+static void releaseTuples(Reln r, Count n)
+{
+	if (n == 0) return;
+	metaLock(r);
+	r->ntups -= n;
+	metaUnlock(r);
+}
+
+
+
+// split the bucket at the split pointer, and advance sp/depth
+// in shared mode, splits happen one at a time, both buckets are
+// latched for the whole split, and the new npages/sp/depth are
+// published before the latches are released
+
+static void splitNext(Reln r)
+{
+	if (r->shared) pthread_mutex_lock(&r->split);
+
+	//printf("reln.c addToRelation time to split at ntups = %u and Pcap = %u \n", r->ntups, Pcap);  //for debug
+
+	uint64_t latches = latchBit(r->sp) | latchBit(r->npages);
+	lockBuckets(r, latches, TRUE);
+
+	bumpBucket(r, r->sp);
+	bumpBucket(r, r->npages);
+	lh_split(r);
+
+	metaLock(r);
+	r->npages += 1;
+	if (r->sp < ((PageID)1 << r->depth) - 1) 
+		r->sp +=1;
+	else {
+		r->sp = 0;
+		r->depth += 1;
 	}
-	if (move != NULL) {
-		if (move->ntuples > 0) flushToBuck(r, newBid, move); else free(move);
+	r->epoch++;
+	metaUnlock(r);
+	unlockBuckets(r, latches);
+
+	if (r->shared) pthread_mutex_unlock(&r->split);
+}
+
+
+
+// find the bucket for a tuple with hash h, and latch it for writing
+// if a split happened before the latch was granted, try again
+// (a split needs the latch, so after that the bucket stays right)
+
+static PageID lockBucketOf(Reln r, Bits h)
+{
+	while (TRUE) {
+		metaLock(r);
+		PageID p = bucketOf(r, h);
+		uint64_t epoch = r->epoch;
+		metaUnlock(r);
+		lockBuckets(r, latchBit(p), TRUE);
+		metaLock(r);
+		Bool same = (r->epoch == epoch);
+		metaUnlock(r);
+		if (same) return p;
+		unlockBuckets(r, latchBit(p));
 	}
-	
-	
-	//printf("reln.c lh_split finishing linear split\n\n");  // for debug
+}
+
 
+
+// add a new (empty) page to the overflow file, reusing a free
+// page if there is one
+// (in shared mode, other writers may be doing the same)
+
+static PageID newOvflowPage(Reln r)
+{
+	if (r->shared) pthread_mutex_lock(&r->grow);
+	PageID pid = r->freeOv;
+	if (pid == NO_PAGE)
+		pid = addPage(r->ovflow);
+	else {
+		Page p = getPage(r->ovflow, pid);
+		r->freeOv = pageOvflow(p);
+		free(p);
+		putPage(r->ovflow, pid, newPage());
+	}
+	if (r->shared) pthread_mutex_unlock(&r->grow);
+	return pid;
+}
+
+// put n overflow pages on the free list (free pages are linked
+// through their ovflow fields); pages[] are buffers for them,
+// which are written out and released
+
+static void freeOvflowPages(Reln r, Count n, PageID *pids, Page *pages)
+{
+	if (n == 0) return;
+	if (r->shared) pthread_mutex_lock(&r->grow);
+	for (Count i = 0; i < n; i++)
+		pages[i]->ovflow = (i + 1 < n) ? pids[i+1] : r->freeOv;
+	r->freeOv = pids[0];
+	writePages(r->io, r->ovflow, n, pids, pages);
+	if (r->shared) pthread_mutex_unlock(&r->grow);
+}
+
+
+
+// map a tuple hash to its bucket (primary page id)
+
+static PageID bucketOf(Reln r, Bits h)
+{
+	PageID p;
+	if (r->depth == 0)
+		p = 0;
+	else {
+		p = getLower(h, r->depth);
+		if (p < r->sp) p = getLower(h, r->depth+1);
+	}
+	return p;
 }
-	
 
 
 
@@ -334,61 +918,46 @@ PageID addToRelation(Reln r, Tuple t)
 	Bits h, p;
 
 	// NEW 
-	// check if need to split
-	Count Pcap = floor(102.4/r->nattrs);
-	assert(Pcap > 0);
-
-	if ( (r->ntups >0) &&((r->ntups % Pcap) == 0)) {
-		
-		//printf("reln.c addToRelation time to split at ntups = %u and Pcap = %u \n", r->ntups, Pcap);  //for debug
-		
-		lh_split(r);
-
-		//printf("reln.c addToRelation successfully split at ntups = %u and Pcap = %u \n", r->ntups, Pcap);  //for debug
-
-		if (r->sp < pow(2, r->depth) - 1) 
-			r->sp +=1;
-		else {
-			r->sp = 0;
-			r->depth += 1;
-		}
-	}
-
-
+	// count the tuple in, and split first if it is time to
+	Count one = 1;
+	if (claimTuples(r, &one)) splitNext(r);
 
 	// hash + insert
 	
 	h = tupleHash(r,t);
-	if (r->depth == 0)
-		p = 0;
-	else {
-		p = getLower(h, r->depth);
-		if (p < r->sp) p = getLower(h, r->depth+1);
-	}
+	p = lockBucketOf(r, h);
 	
 	//char buf[MAXBITS+5]; //*** for debug
 	//bitsString(h,buf); printf("hash %s = %s\n",t, buf); //*** for debug
 	//bitsString(p,buf); printf("page = %s\n",buf); //*** for debug
 
+	PageID ok = insertIntoBucket(r, p, t);
+	bumpBucket(r, p);
+	unlockBuckets(r, latchBit(p));
+	if (ok == NO_PAGE) releaseTuples(r, 1);
+	return ok;
+}
 
+// add a tuple to bucket p's chain of pages
+// returns p, or NO_PAGE if the tuple can't be stored
 
+static PageID insertIntoBucket(Reln r, PageID p, Tuple t)
+{
 	Page pg = getPage(r->data,p);
-	if (addToPage(pg,t) == OK) {
+	if (addTuple(r,pg,t) == OK) {
 		putPage(r->data,p,pg);
-		r->ntups++;
 		return p;
 	}
 	// primary data page full
 	if (pageOvflow(pg) == NO_PAGE) {
 		// add first overflow page in chain
-		PageID newp = addPage(r->ovflow);
+		PageID newp = newOvflowPage(r);
 		pageSetOvflow(pg,newp);
 		putPage(r->data,p,pg);
 		Page newpg = getPage(r->ovflow,newp);
 		// can't add to a new page; we have a problem
-		if (addToPage(newpg,t) != OK) return NO_PAGE;
+		if (addTuple(r,newpg,t) != OK) return NO_PAGE;
 		putPage(r->ovflow,newp,newpg);
-		r->ntups++;
 		return p;
 	}
 	else {
@@ -400,7 +969,7 @@ PageID addToRelation(Reln r, Tuple t)
 		free(pg);
 		while (ovp != NO_PAGE) {
 			ovpg = getPage(r->ovflow, ovp);
-			if (addToPage(ovpg,t) != OK) {
+			if (addTuple(r,ovpg,t) != OK) {
 			    if (prevpg != NULL) free(prevpg);
 				prevp = ovp; prevpg = ovpg;
 				ovp = pageOvflow(ovpg);
@@ -408,7 +977,6 @@ PageID addToRelation(Reln r, Tuple t)
 			else {
 				if (prevpg != NULL) free(prevpg);
 				putPage(r->ovflow,ovp,ovpg);
-				r->ntups++;
 				return p;
 			}
 		}
@@ -416,59 +984,542 @@ PageID addToRelation(Reln r, Tuple t)
 		// at this point, there *must* be a prevpg
 		assert(prevpg != NULL);
 		// make new ovflow page
-		PageID newp = addPage(r->ovflow);
+		PageID newp = newOvflowPage(r);
 		// insert tuple into new page
 		Page newpg = getPage(r->ovflow,newp);
-        if (addToPage(newpg,t) != OK) return NO_PAGE;
+        if (addTuple(r,newpg,t) != OK) return NO_PAGE;
         putPage(r->ovflow,newp,newpg);
 		// link to existing overflow chain
 		pageSetOvflow(prevpg,newp);
 		putPage(r->ovflow,prevp,prevpg);
-        r->ntups++;
 		return p;
 	}
 	return NO_PAGE;
 }
 
+// insert n tuples into a relation, batching page I/O
+// tuples end up in the same pages as with n calls to addToRelation(),
+// but between splits each page is read and written at most once
+// returns the number of tuples inserted
+
+Count addTuplesToRelation(Reln r, Tuple *ts, Count n)
+{
+	Count i = 0, ok = 0;
+	Arena mem = newArena(INSCHUNK);
+	while (i < n) {
+		// #tuples that can go in before the next split
+		Count run = n - i;
+		if (claimTuples(r, &run)) splitNext(r);
+		Count done = insertRun(r, ts + i, run, mem);
+		arenaReset(mem);
+		releaseTuples(r, run - done);
+		ok += done;
+		i += run;
+	}
+	countAllocs(r, mem);
+	freeArena(mem);
+	return ok;
+}
+
+// insert n tuples using nthreads threads (shared mode only)
+// each thread inserts interleaved chunks of the tuples, as
+// addTuplesToRelation() does; tuples in different buckets go
+// in in parallel, and only splits are serialised
+// returns the number of tuples inserted
+
+typedef struct {
+	Reln   r;
+	Tuple *ts;
+	Count  n, nthreads, id;
+	Count  ok;
+} InsertJob;
+
+static void *insertWorker(void *arg)
+{
+	InsertJob *job = arg;
+	job->ok = 0;
+	for (Count i = job->id * PARCHUNK; i < job->n; i += job->nthreads * PARCHUNK) {
+		Count m = (job->n - i < PARCHUNK) ? job->n - i : PARCHUNK;
+		job->ok += addTuplesToRelation(job->r, job->ts + i, m);
+	}
+	return NULL;
+}
+
+Count addTuplesParallel(Reln r, Tuple *ts, Count n, Count nthreads)
+{
+	if (!r->shared || nthreads <= 1) return addTuplesToRelation(r, ts, n);
+
+	pthread_t   tid[nthreads];
+	InsertJob   job[nthreads];
+	Count ok = 0;
+	for (Count k = 0; k < nthreads; k++) {
+		job[k] = (InsertJob){ r, ts, n, nthreads, k, 0 };
+		if (pthread_create(&tid[k], NULL, insertWorker, &job[k]) != 0)
+			fatal("Can't start insert thread");
+	}
+	for (Count k = 0; k < nthreads; k++) {
+		pthread_join(tid[k], NULL);
+		ok += job[k].ok;
+	}
+	return ok;
+}
+
+// delete the tuples t in bucket bid for which drop(arg, t) is TRUE
+// the bucket's remaining tuples are packed into as few pages as
+// they need; overflow pages left empty go on the free list
+// (not in shared mode) returns the number of tuples deleted
+
+uint64_t deleteFromBucket(Reln r, PageID bid, Bool (*drop)(void *, Tuple), void *arg)
+{
+	assert(!r->shared && bid < r->npages);
+	PageID	*pids;
+	Page	*chain, *fill;
+	uint64_t ndel;
+	Count	nchain = readChain(r, bid, &pids, &chain);
+	Count	nfill = repackPages(r, nchain, chain, drop, arg, &fill, &ndel);
+
+	if (ndel == 0) {
+		for (Count i = 0; i < nchain; i++) free(chain[i]);
+		for (Count i = 0; i < nfill; i++) free(fill[i]);
+	} else {
+		rewriteBucket(r, nchain, pids, chain, nfill, fill);
+		r->ntups -= ndel;
+		bumpBucket(r, bid);
+	}
+	free(pids); free(chain); free(fill);
+	return ndel;
+}
+
+// after deletes, merge buckets while the relation holds fewer than
+// MINLOAD of the tuples that would make it split to its size
+// (not in shared mode; open Selections must be closed first, as
+// buckets past the end of the relation disappear)
+
+void shrinkRelation(Reln r)
+{
+	Count Pcap = splitEvery(r);
+	assert(!r->shared);
+
+	while (r->npages > 1 && r->ntups < MINLOAD * Pcap * r->npages) {
+		lh_merge(r);
+		bumpBucket(r, r->sp);
+		bumpBucket(r, r->npages);
+		r->epoch++;
+	}
+}
+
+// find page pid in a set of n pages held in memory
+// returns its index, or n if not there
+
+static Count findPage(Count n, PageID *pids, PageID pid)
+{
+	Count i;
+	for (i = 0; i < n; i++) if (pids[i] == pid) break;
+	return i;
+}
+
+// insert a run of tuples during which no split is due
+// - the run's buckets stay latched (shared mode), so no other
+//   writer's split can move their tuples meanwhile
+// - distinct primary pages are read in one batch
+// - overflow pages are read when first needed and kept
+// - all changed pages are written in one batch per file
+// - page buffers and the overflow page lists come from mem
+
+static Count insertRun(Reln r, Tuple *ts, Count n, Arena mem)
+{
+	PageID	bids[n], pids[n];
+	Page	pages[n];
+	Bool	dirty[n];
+	Count	nb = 0, ok = 0;
+
+	// find the distinct primary pages and read them together
+	// (latched; if a split got in first, find them again)
+	Bits	h[n];
+	uint64_t latches = 0;
+	for (Count i = 0; i < n; i++) h[i] = tupleHash(r, ts[i]);
+	while (TRUE) {
+		metaLock(r);
+		uint64_t epoch = r->epoch;
+		nb = 0; latches = 0;
+		for (Count i = 0; i < n; i++) {
+			bids[i] = bucketOf(r, h[i]);
+			if (findPage(nb, pids, bids[i]) == nb) {
+				dirty[nb] = FALSE;
+				pids[nb++] = bids[i];
+				latches |= latchBit(bids[i]);
+			}
+		}
+		metaUnlock(r);
+		lockBuckets(r, latches, TRUE);
+		metaLock(r);
+		Bool same = (r->epoch == epoch);
+		metaUnlock(r);
+		if (same) break;
+		unlockBuckets(r, latches);
+	}
+	for (Count j = 0; j < nb; j++) pages[j] = arenaPage(mem);
+	readPagesInto(r->io, r->data, nb, pids, pages);
+	for (Count j = 0; j < nb; j++) bumpBucket(r, pids[j]);
+
+	// overflow pages touched in this run
+	Count	nov = 0, maxov = 8;
+	PageID	*opids = arenaAlloc(mem, maxov * sizeof(PageID));
+	Page	*opages = arenaAlloc(mem, maxov * sizeof(Page));
+	Bool	*odirty = arenaAlloc(mem, maxov * sizeof(Bool));
+
+	// add each tuple to the first page in its bucket with room
+	for (Count i = 0; i < n; i++) {
+		Count	j = findPage(nb, pids, bids[i]);
+		if (addTuple(r, pages[j], ts[i]) == OK) {
+			dirty[j] = TRUE; ok++;
+			continue;
+		}
+		// walk the overflow chain; prev is the index of the
+		// previous overflow page (or -1 for the primary page)
+		int		prev = -1;
+		PageID	ovp = pageOvflow(pages[j]);
+		while (TRUE) {
+			Count k = (ovp == NO_PAGE) ? nov : findPage(nov, opids, ovp);
+			if (k == nov && nov == maxov) {
+				maxov *= 2;
+				PageID *ip = arenaAlloc(mem, maxov * sizeof(PageID));
+				Page *pp = arenaAlloc(mem, maxov * sizeof(Page));
+				Bool *dp = arenaAlloc(mem, maxov * sizeof(Bool));
+				memcpy(ip, opids, nov * sizeof(PageID));
+				memcpy(pp, opages, nov * sizeof(Page));
+				memcpy(dp, odirty, nov * sizeof(Bool));
+				opids = ip; opages = pp; odirty = dp;
+			}
+			if (ovp == NO_PAGE) {
+				// all pages full; add another to the chain
+				opids[nov] = newOvflowPage(r);
+				opages[nov] = arenaPage(mem);
+				initPage(opages[nov]);
+				odirty[nov] = TRUE;
+				if (prev < 0) {
+					pageSetOvflow(pages[j], opids[nov]);
+					dirty[j] = TRUE;
+				} else {
+					pageSetOvflow(opages[prev], opids[nov]);
+					odirty[prev] = TRUE;
+				}
+				// can't add to a new page; give up on this tuple
+				if (addTuple(r, opages[nov], ts[i]) == OK) ok++;
+				nov++;
+				break;
+			}
+			if (k == nov) {
+				opids[nov] = ovp;
+				opages[nov] = arenaPage(mem);
+				readPage(r->ovflow, ovp, opages[nov]);
+				odirty[nov] = FALSE;
+				nov++;
+			}
+			if (addTuple(r, opages[k], ts[i]) == OK) {
+				odirty[k] = TRUE; ok++;
+				break;
+			}
+			prev = k;
+			ovp = pageOvflow(opages[k]);
+		}
+	}
+
+	// write changed pages in one batch per file
+	Count	nw = 0;
+	for (Count j = 0; j < nb; j++)
+		if (dirty[j]) { pids[nw] = pids[j]; pages[nw] = pages[j]; nw++; }
+	writePagesFrom(r->io, r->data, nw, pids, pages);
+	nw = 0;
+	for (Count k = 0; k < nov; k++)
+		if (odirty[k]) { opids[nw] = opids[k]; opages[nw] = opages[k]; nw++; }
+	writePagesFrom(r->io, r->ovflow, nw, opids, opages);
+	unlockBuckets(r, latches);
+
+	return ok;
+}
+
+
+
+// shared mode (concurrent=on): bucket latches and relation metadata
+// - writers hold a bucket's latch exclusively while changing any
+//   page in its chain, and both buckets' latches during a split
+// - readers hold the latches of the buckets they are reading (shared)
+// - latches are always acquired in increasing order
+// outside shared mode, these do nothing
+
+static uint64_t latchBit(PageID b)
+{
+	return (uint64_t)1 << (b % NLATCHES);
+}
+
+static void lockBuckets(Reln r, uint64_t latches, Bool write)
+{
+	if (!r->shared) return;
+	for (int i = 0; i < NLATCHES; i++) {
+		if ((latches & ((uint64_t)1 << i)) == 0) continue;
+		if (write)
+			pthread_rwlock_wrlock(&r->latch[i]);
+		else
+			pthread_rwlock_rdlock(&r->latch[i]);
+	}
+}
+
+static void unlockBuckets(Reln r, uint64_t latches)
+{
+	if (!r->shared) return;
+	for (int i = 0; i < NLATCHES; i++)
+		if (latches & ((uint64_t)1 << i)) pthread_rwlock_unlock(&r->latch[i]);
+}
+
+static void metaLock(Reln r) { if (r->shared) pthread_mutex_lock(&r->meta); }
+static void metaUnlock(Reln r) { if (r->shared) pthread_mutex_unlock(&r->meta); }
+
+// take a consistent copy of the relation's shape (depth, sp, npages)
+// a Selection addresses buckets using the snapshot taken when it started
+
+void relnSnapshot(Reln r, RelnSnapshot *snap)
+{
+	metaLock(r);
+	snap->depth = r->depth;
+	snap->sp = r->sp;
+	snap->npages = r->npages;
+	snap->epoch = r->epoch;
+	metaUnlock(r);
+}
+
+// the shape a relation like r would have after ntups tuples were
+// inserted into it, starting from one page (the epoch is 0)
+
+void relnShapeFor(Reln r, uint64_t ntups, RelnSnapshot *snap)
+{
+	snap->npages = 1 + (ntups > 0 ? (ntups - 1) / splitEvery(r) : 0);
+	snap->depth = 0;
+	while (((PageID)2 << snap->depth) <= snap->npages) snap->depth++;
+	snap->sp = snap->npages - ((PageID)1 << snap->depth);
+	snap->epoch = 0;
+}
+
+// the ngram= setting of r ("off", or its attributes) into buf
+
+static void sigsString(Reln r, char *buf)
+{
+	strcpy(buf, "off");
+	for (Count i = 0; i < r->nsigs; i++)
+		sprintf(buf + (i == 0 ? 0 : strlen(buf)), "%s%d",
+		        i == 0 ? "" : ":", r->sigAttrs[i]+1);
+}
+
+// r's creation-time options, as given to newRelationOpts(),
+// written into buf (MAXRELOPTS bytes)
+
+void relnCreateOpts(Reln r, char *buf)
+{
+	char sigs[MAXSIGS*4+4];
+	sigsString(r, sigs);
+	Count n = sprintf(buf, "hash=%s,layout=%s,compress=%s,zonemap=%s,ngram=%s",
+	                  hashFnName(r->hashfn), r->layout == PAGE_PAX ? "pax" : "row",
+	                  r->layout == PAGE_DICT ? "dict" : "none",
+	                  r->nzones > 0 ? "on" : "off", sigs);
+	if (r->layout == PAGE_TYPED) {
+		strcpy(buf + n, ",schema=");
+		schemaString(r->types, r->nattrs, buf + n + strlen(",schema="));
+	}
+}
+
+// the buckets now holding the tuples that were in bucket bid when
+// snap was taken: bid itself, plus any buckets split off it since
+// (bucket x was split off the bucket x without its top bit)
+// sets *latches to the latches guarding them; returns how many
+
+static Count bucketFamily(Reln r, RelnSnapshot *snap, PageID bid, PageID **fam, uint64_t *latches)
+{
+	metaLock(r);
+	PageID np = r->npages;
+	uint64_t epoch = r->epoch;
+	metaUnlock(r);
+	if (epoch == snap->epoch) np = snap->npages;
+	assert(np >= snap->npages);
+
+	*fam = realloc(*fam, (1 + np - snap->npages) * sizeof(PageID));
+	assert(*fam != NULL);
+	Count n = 0;
+	(*fam)[n++] = bid;
+	*latches = latchBit(bid);
+	for (PageID x = snap->npages; x < np; x++) {
+		PageID a = x;
+		while (a >= snap->npages)
+			a &= ~((PageID)1 << (63 - __builtin_clzll(a)));
+		if (a == bid) {
+			(*fam)[n++] = x;
+			*latches |= latchBit(x);
+		}
+	}
+	return n;
+}
+
+// read all pages (primary and overflow) of the buckets holding the
+// tuples that were in bucket bid when snap was taken
+// in shared mode, the buckets' latches are held while reading,
+// so the pages give a consistent picture even if the writer
+// has split them in the meantime
+// *pages is set to a new array of page buffers; returns how many
+
+Count readBucket(Reln r, RelnSnapshot *snap, PageID bid, Page **pages)
+{
+	PageID *fam = NULL;
+	uint64_t held = 0, want;
+	Count nfam = bucketFamily(r, snap, bid, &fam, &want);
+
+	// latch the family; a split may have added members meanwhile
+	while (r->shared && (want & ~held) != 0) {
+		unlockBuckets(r, held);
+		lockBuckets(r, want, FALSE);
+		held = want;
+		nfam = bucketFamily(r, snap, bid, &fam, &want);
+	}
+
+	Count n = 0, max = 8;
+	Page *ps = malloc(max * sizeof(Page));
+	assert(ps != NULL);
+	for (Count i = 0; i < nfam; i++) {
+		Page p = getPage(r->data, fam[i]);
+		while (TRUE) {
+			if (n == max) {
+				max *= 2;
+				ps = realloc(ps, max * sizeof(Page));
+				assert(ps != NULL);
+			}
+			ps[n++] = p;
+			if (pageOvflow(p) == NO_PAGE) break;
+			p = getPage(r->ovflow, pageOvflow(p));
+		}
+	}
+	unlockBuckets(r, held);
+	free(fam);
+	*pages = ps;
+	return n;
+}
+
 // external interfaces for Reln data
 
 FILE *dataFile(Reln r) { return r->data; }
 FILE *ovflowFile(Reln r) { return r->ovflow; }
 Count nattrs(Reln r) { return r->nattrs; }
-Count npages(Reln r) { return r->npages; }
-Count ntuples(Reln r) { return r->ntups; }
+PageID npages(Reln r) { return r->npages; }
+PageID novflow(Reln r) { return filePages(r->ovflow); }
+uint64_t ntuples(Reln r) { return r->ntups; }
 Count depth(Reln r)  { return r->depth; }
-Count splitp(Reln r) { return r->sp; }
+PageID splitp(Reln r) { return r->sp; }
 ChVecItem *chvec(Reln r)  { return r->cv; }
+int hashfn(Reln r) { return r->hashfn; }
+int layout(Reln r) { return r->layout; }
+
+// the types of r's attributes (NULL if it has no schema)
+AttrType *attrTypes(Reln r)
+{
+	return (r->layout == PAGE_TYPED) ? r->types : NULL;
+}
+
+// the type of attribute a (TYPE_TEXT if r has no schema)
+AttrType attrType(Reln r, Count a)
+{
+	AttrType text = { TYPE_TEXT, 0 };
+	return (r->layout == PAGE_TYPED) ? r->types[a] : text;
+}
+PageIO pageIO(Reln r) { return r->io; }
+Bool relnShared(Reln r) { return r->shared; }
+QCache relnCache(Reln r) { return r->cache; }
+
+// add a finished arena's counts to the relation's totals
+// (see relationStats())
+
+void countAllocs(Reln r, Arena a)
+{
+	__atomic_fetch_add(&r->nallocs, arenaAllocs(a), __ATOMIC_RELAXED);
+	__atomic_fetch_add(&r->nmallocs, arenaMallocs(a), __ATOMIC_RELAXED);
+}
+
+// are all the hash bits that choose a bucket (in a relation of
+// shape snap) taken from the n attributes in attrs[]? then tuples
+// that agree on those attributes are always in the same bucket
+// (buckets before sp use depth+1 bits, the others depth bits)
+
+Bool bucketChosenBy(Reln r, RelnSnapshot *snap, Count n, Count *attrs)
+{
+	Count nbits = (snap->sp == 0) ? snap->depth : snap->depth + 1;
+	for (Count i = 0; i < nbits; i++) {
+		Bool found = FALSE;
+		for (Count j = 0; j < n; j++) if (r->cv[i].att == attrs[j]) found = TRUE;
+		if (!found) return FALSE;
+	}
+	return TRUE;
+}
+
+// the version of bucket b: it changes whenever a tuple is added to
+// the bucket or the bucket is split (only kept if there is a cache)
+
+uint64_t bucketVersion(Reln r, PageID b)
+{
+	return (b < r->nversions) ? r->versions[b] : 0;
+}
+
+static void bumpBucket(Reln r, PageID b)
+{
+	if (r->cache == NULL) return;
+	if (b >= r->nversions) {
+		PageID n = (r->nversions == 0) ? 64 : r->nversions;
+		while (n <= b) n *= 2;
+		r->versions = realloc(r->versions, n * sizeof(uint64_t));
+		assert(r->versions != NULL);
+		memset(r->versions + r->nversions, 0, (n - r->nversions) * sizeof(uint64_t));
+		r->nversions = n;
+	}
+	r->versions[b]++;
+}
 
 
 // displays info about open Reln
 
 void relationStats(Reln r)
 {
+	char sigs[MAXSIGS*4+4];
+	sigsString(r, sigs);
 	printf("Global Info:\n");
-	printf("#attrs:%d  #pages:%d  #tuples:%d  d:%d  sp:%d\n",
-	       r->nattrs, r->npages, r->ntups, r->depth, r->sp);
+	printf("#attrs:%d  #pages:%"PRIu64"  #tuples:%"PRIu64"  d:%d  sp:%"PRIu64"  hash:%s  layout:%s  zonemap:%s  ngram:%s\n",
+	       r->nattrs, r->npages, r->ntups, r->depth, r->sp, hashFnName(r->hashfn),
+	       layoutName(r->layout), r->nzones > 0 ? "on" : "off", sigs);
+	if (r->layout == PAGE_TYPED) {
+		char schema[MAXSCHEMA];
+		schemaString(r->types, r->nattrs, schema);
+		printf("Schema: %s\n", schema);
+	}
 	printf("Choice vector\n");
 	printChVec(r->cv);
+	printf("I/O: %s%s\n", pageIOName(pageIOKind(r->io)),
+	       pageIODirect(r->io) ? " (direct)" : "");
+	if (r->cache != NULL) qcacheStats(r->cache);
+	printf("Memory: %"PRIu64" arena allocations, %"PRIu64" mallocs (since open)\n",
+	       r->nallocs, r->nmallocs);
+	printf("Delimiter scan: %s\n", delimKernelName());
 	printf("Bucket Info:\n");
 	printf("%-4s %s\n","#","Info on pages in bucket");
 	printf("%-4s %s\n","","(pageID,#tuples,freebytes,ovflow)");
-	for (Offset pid = 0; pid < r->npages; pid++) {
-		printf("[%2d]  ",pid);
+	for (PageID pid = 0; pid < r->npages; pid++) {
+		printf("[%2"PRIu64"]  ",pid);
 		Page p = getPage(r->data, pid);
 		Count ntups = pageNTuples(p);
 		Count space = pageFreeSpace(p);
-		Offset ovid = pageOvflow(p);
-		printf("(d%d,%d,%d,%d)",pid,ntups,space,ovid);
+		PageID ovid = pageOvflow(p);
+		printf("(d%"PRIu64",%d,%d,%"PRId64")",pid,ntups,space,(int64_t)ovid);
 		free(p);
 		while (ovid != NO_PAGE) {
-			Offset curid = ovid;
+			PageID curid = ovid;
 			p = getPage(r->ovflow, ovid);
 			ntups = pageNTuples(p);
 			space = pageFreeSpace(p);
 			ovid = pageOvflow(p);
-			printf(" -> (ov%d,%d,%d,%d)",curid,ntups,space,ovid);
+			printf(" -> (ov%"PRIu64",%d,%d,%"PRId64")",curid,ntups,space,(int64_t)ovid);
 			free(p);
 		}
 		putchar('\n');
@@ -12,19 +12,56 @@ typedef struct RelnRep *Reln;
 #include "tuple.h"
 #include "page.h"
 #include "chvec.h"
+#include "pageio.h"
+#include "qcache.h"
+#include "arena.h"
+#include "schema.h"
+
+// longest options string for newRelationOpts() (and relnCreateOpts())
+#define MAXRELOPTS  (MAXERRMSG + MAXSCHEMA)
+
+// the shape of a relation at some moment (see relnSnapshot())
+typedef struct RelnSnapshot {
+	Count    depth;
+	PageID   sp;
+	PageID   npages;
+	uint64_t epoch;   // changes with every split
+} RelnSnapshot;
 
 Status newRelation(char *name, Count nattr, Count npages, Count d, char *cv);
+Status newRelationOpts(char *name, Count nattr, Count npages, Count d, char *cv, char *opts);
 Reln openRelation(char *name, char *mode);
+Reln openRelationOpts(char *name, char *mode, char *opts);
 void closeRelation(Reln r);
 Bool existsRelation(char *name);
 PageID addToRelation(Reln r, Tuple t);
+Count addTuplesToRelation(Reln r, Tuple *ts, Count n);
+Count addTuplesParallel(Reln r, Tuple *ts, Count n, Count nthreads);
+uint64_t deleteFromBucket(Reln r, PageID bid, Bool (*drop)(void *, Tuple), void *arg);
+void shrinkRelation(Reln r);
 FILE *dataFile(Reln r);
 FILE *ovflowFile(Reln r);
 Count nattrs(Reln r);
-Count npages(Reln r);
+PageID npages(Reln r);
+PageID novflow(Reln r);
+uint64_t ntuples(Reln r);
 Count depth(Reln r);
-Count splitp(Reln r);
+PageID splitp(Reln r);
 ChVecItem *chvec(Reln r);
+int hashfn(Reln r);
+int layout(Reln r);
+AttrType *attrTypes(Reln r);
+AttrType attrType(Reln r, Count a);
+PageIO pageIO(Reln r);
+Bool relnShared(Reln r);
+void relnSnapshot(Reln r, RelnSnapshot *snap);
+void relnShapeFor(Reln r, uint64_t ntups, RelnSnapshot *snap);
+void relnCreateOpts(Reln r, char *buf);
+Count readBucket(Reln r, RelnSnapshot *snap, PageID bid, Page **pages);
+QCache relnCache(Reln r);
+void countAllocs(Reln r, Arena a);
+Bool bucketChosenBy(Reln r, RelnSnapshot *snap, Count n, Count *attrs);
+uint64_t bucketVersion(Reln r, PageID b);
 void relationStats(Reln r);
 
 #endif
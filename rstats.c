@@ -0,0 +1,282 @@
+// rstats.c ... distribution statistics for relations
+// part of Multi-attribute Linear-hashed Files
+// Summarise how a relation's tuples are spread over its pages
+
+#include "defs.h"
+#include "rstats.h"
+#include "reln.h"
+#include "page.h"
+#include "pageio.h"
+#include "chvec.h"
+#include "tuple.h"
+#include "arena.h"
+
+// relationStatsJSON() describes the shape of a relation, for
+// monitoring rather than for reading bucket by bucket (as with
+// relationStats()): how long the buckets' overflow chains are,
+// how full the buckets are, how many overflow pages hold nothing,
+// how many tuples the pages hold, and how evenly each choice vector
+// bit splits the tuples; a bit that is nearly always 0 (or 1) puts
+// most tuples in half of the buckets it chooses between, so the
+// attributes such bits come from are flagged as skewed
+// (attributes are numbered from 0, as in the choice vector)
+//
+// The overflow file is read first, front to back, noting each page's
+// successor; then the data file, and the chains are followed in
+// memory; both files are read STATRUN pages at a time (see readRun())
+// With concurrent=on, pages may only be read under their bucket's
+// latches, so each bucket is read with readBucket() instead
+//
+// Overflow pages that are in no chain are on the free list (pages
+// emptied by deletes and merges; see freeOvflowPages() in reln.c)
+
+#define STATRUN    64     // pages read at a time
+#define SKEWLIMIT  0.1    // a bit is skewed if its share of 1s is
+                          // further than this from 0.5
+#define MINSKEW    100    // tuples needed before skew is judged
+#define FILLBINS   10     // fill factor histogram bins
+
+typedef struct {
+	Reln     rel;
+	Count    nbits;              // choice vector bits in use (depth+1)
+	uint64_t ones[MAXCHVEC];     // tuples with each hash bit set
+	uint64_t ntuples;
+	uint64_t npages;             // pages in chains (primary + overflow)
+	uint64_t inChains;           // overflow pages in chains
+	uint64_t emptyInChains;      // ... that hold no tuples
+	Count    minTups, maxTups;   // per page in chains
+	uint64_t *chainHist;         // #buckets with each #overflow pages
+	Count    maxChain;
+	PageID   longest;            // first bucket with the longest chain
+	uint64_t fillHist[FILLBINS]; // #buckets by fill factor
+	double   fillSum, fillMin, fillMax;
+} Stats;
+
+static void hashTuples(Stats *st, Page p);
+static void countPage(Stats *st, Count ntups, Bool ovflow);
+static void countBucket(Stats *st, PageID b, Count chain, uint64_t used, uint64_t cap);
+static void scanFiles(Stats *st);
+static void scanBuckets(Stats *st);
+static void writeJSON(Stats *st, FILE *out);
+
+
+// write statistics on relation r as a JSON object to out
+// (see the top of this file)
+
+void relationStatsJSON(Reln r, FILE *out)
+{
+	Stats st;
+	memset(&st, 0, sizeof(st));
+	st.rel = r;
+	st.nbits = depth(r) + 1;
+	if (st.nbits > MAXCHVEC) st.nbits = MAXCHVEC;
+	st.minTups = ~0u;
+	st.fillMin = 1.0;
+	st.chainHist = calloc(1, sizeof(uint64_t));
+	assert(st.chainHist != NULL);
+
+	if (relnShared(r)) scanBuckets(&st);
+	else scanFiles(&st);
+	writeJSON(&st, out);
+	free(st.chainHist);
+}
+
+
+
+// count the hash bits in use of each tuple in page p
+
+static void hashTuples(Stats *st, Page p)
+{
+	PageScan scan;
+	char     buf[MAXTUPLEN];
+	Tuple    t;
+
+	if (pageNTuples(p) == 0) return;
+	startPageScan(p, &scan);
+	while ((t = nextPageTuple(p, &scan, buf)) != NULL) {
+		Bits h = tupleHash(st->rel, t);
+		for (Count i = 0; i < st->nbits; i++)
+			st->ones[i] += (h >> i) & 1;
+	}
+}
+
+// note a page (holding ntups tuples) in some bucket's chain
+
+static void countPage(Stats *st, Count ntups, Bool ovflow)
+{
+	st->npages++;
+	st->ntuples += ntups;
+	if (ntups < st->minTups) st->minTups = ntups;
+	if (ntups > st->maxTups) st->maxTups = ntups;
+	if (ovflow) {
+		st->inChains++;
+		if (ntups == 0) st->emptyInChains++;
+	}
+}
+
+// note bucket b, with chain overflow pages, whose pages have
+// used bytes of tuples out of cap bytes
+
+static void countBucket(Stats *st, PageID b, Count chain, uint64_t used, uint64_t cap)
+{
+	if (chain > st->maxChain) {
+		st->chainHist = realloc(st->chainHist, (chain + 1) * sizeof(uint64_t));
+		assert(st->chainHist != NULL);
+		memset(st->chainHist + st->maxChain + 1, 0,
+		       (chain - st->maxChain) * sizeof(uint64_t));
+		st->maxChain = chain;
+		st->longest = b;
+	}
+	st->chainHist[chain]++;
+
+	double fill = (cap > 0) ? (double)used / cap : 0.0;
+	Count bin = (Count)(fill * FILLBINS);
+	st->fillHist[bin < FILLBINS ? bin : FILLBINS - 1]++;
+	st->fillSum += fill;
+	if (fill < st->fillMin) st->fillMin = fill;
+	if (fill > st->fillMax) st->fillMax = fill;
+}
+
+// gather the statistics in one sequential pass over each file
+
+static void scanFiles(Stats *st)
+{
+	Reln    r = st->rel;
+	PageIO  io = pageIO(r);
+	PageID  nov = novflow(r), np = npages(r);
+	Arena   mem = newArena(STATRUN * PAGESIZE);
+	Page    run = arenaPages(mem, STATRUN);
+
+	// overflow pages: successor, tuples, bytes used and capacity
+	PageID  *next = arenaAlloc(mem, nov * sizeof(PageID) + 1);
+	Count   *ntups = arenaAlloc(mem, nov * sizeof(Count) + 1);
+	Count   *used = arenaAlloc(mem, nov * sizeof(Count) + 1);
+	Count   *cap = arenaAlloc(mem, nov * sizeof(Count) + 1);
+	Bool    *seen = arenaAlloc(mem, nov + 1);
+	memset(seen, FALSE, nov);
+
+	for (PageID first = 0; first < nov; ) {
+		Count n = (nov - first < STATRUN) ? nov - first : STATRUN;
+		n = readRun(io, ovflowFile(r), first, n, run);
+		if (n == 0) { nov = first; break; }
+		for (Count i = 0; i < n; i++) {
+			Page p = (Page)((char *)run + (size_t)i * PAGESIZE);
+			next[first + i] = pageOvflow(p);
+			ntups[first + i] = pageNTuples(p);
+			cap[first + i] = pageCapacity(p);
+			used[first + i] = cap[first + i] - pageFreeSpace(p);
+			hashTuples(st, p);
+		}
+		first += n;
+	}
+
+	for (PageID first = 0; first < np; ) {
+		Count n = (np - first < STATRUN) ? np - first : STATRUN;
+		n = readRun(io, dataFile(r), first, n, run);
+		if (n == 0) break;
+		for (Count i = 0; i < n; i++) {
+			Page p = (Page)((char *)run + (size_t)i * PAGESIZE);
+			uint64_t u = pageCapacity(p) - pageFreeSpace(p);
+			uint64_t c = pageCapacity(p);
+			Count    chain = 0;
+			countPage(st, pageNTuples(p), FALSE);
+			hashTuples(st, p);
+			// (a page already seen would mean a broken chain)
+			for (PageID ov = pageOvflow(p); ov < nov && !seen[ov]; ov = next[ov]) {
+				seen[ov] = TRUE;
+				countPage(st, ntups[ov], TRUE);
+				u += used[ov];
+				c += cap[ov];
+				chain++;
+			}
+			countBucket(st, first + i, chain, u, c);
+		}
+		first += n;
+	}
+	freeArena(mem);
+}
+
+// gather the statistics bucket by bucket, under the buckets' latches
+
+static void scanBuckets(Stats *st)
+{
+	RelnSnapshot snap;
+	relnSnapshot(st->rel, &snap);
+	for (PageID b = 0; b < snap.npages; b++) {
+		Page     *pages;
+		Count    n = readBucket(st->rel, &snap, b, &pages);
+		uint64_t u = 0, c = 0;
+		for (Count i = 0; i < n; i++) {
+			countPage(st, pageNTuples(pages[i]), i > 0);
+			hashTuples(st, pages[i]);
+			u += pageCapacity(pages[i]) - pageFreeSpace(pages[i]);
+			c += pageCapacity(pages[i]);
+			free(pages[i]);
+		}
+		free(pages);
+		countBucket(st, b, n - 1, u, c);
+	}
+}
+
+// the statistics, as a JSON object
+
+static void writeJSON(Stats *st, FILE *out)
+{
+	Reln       r = st->rel;
+	ChVecItem  *cv = chvec(r);
+	PageID     np = npages(r), nov = novflow(r);
+	uint64_t   nb = 0;
+	Bool       skewed[MAXATTRS];
+
+	for (Count i = 0; i <= st->maxChain; i++) nb += st->chainHist[i];
+	if (st->npages == 0) st->minTups = 0;
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"attrs\": %d, \"tuples\": %"PRIu64", \"pages\": %"PRIu64
+	        ", \"overflow_pages\": %"PRIu64", \"depth\": %d, \"sp\": %"PRIu64",\n",
+	        nattrs(r), st->ntuples, np, nov, depth(r), splitp(r));
+
+	fprintf(out, "  \"chains\": { \"mean\": %.3f, \"max\": %d, \"longest_bucket\": %"PRIu64
+	        ", \"histogram\": {", nb > 0 ? (double)st->inChains / nb : 0.0,
+	        st->maxChain, st->longest);
+	Bool first = TRUE;
+	for (Count i = 0; i <= st->maxChain; i++) {
+		if (st->chainHist[i] == 0) continue;
+		fprintf(out, "%s\"%d\": %"PRIu64, first ? " " : ", ", i, st->chainHist[i]);
+		first = FALSE;
+	}
+	fprintf(out, " } },\n");
+
+	fprintf(out, "  \"fill\": { \"mean\": %.3f, \"min\": %.3f, \"max\": %.3f, \"histogram\": [",
+	        nb > 0 ? st->fillSum / nb : 0.0, nb > 0 ? st->fillMin : 0.0, st->fillMax);
+	for (Count i = 0; i < FILLBINS; i++)
+		fprintf(out, "%s%"PRIu64, i == 0 ? " " : ", ", st->fillHist[i]);
+	fprintf(out, " ] },\n");
+
+	fprintf(out, "  \"overflow\": { \"in_chains\": %"PRIu64", \"empty_in_chains\": %"PRIu64
+	        ", \"free\": %"PRIu64" },\n", st->inChains, st->emptyInChains,
+	        nov > st->inChains ? nov - st->inChains : 0);
+
+	fprintf(out, "  \"tuples_per_page\": { \"mean\": %.3f, \"min\": %d, \"max\": %d },\n",
+	        st->npages > 0 ? (double)st->ntuples / st->npages : 0.0, st->minTups, st->maxTups);
+
+	memset(skewed, FALSE, sizeof(skewed));
+	fprintf(out, "  \"bits\": [");
+	for (Count i = 0; i < st->nbits; i++) {
+		double ones = (st->ntuples > 0) ? (double)st->ones[i] / st->ntuples : 0.0;
+		Bool   skew = st->ntuples >= MINSKEW && (ones < 0.5 - SKEWLIMIT || ones > 0.5 + SKEWLIMIT);
+		if (skew) skewed[cv[i].att] = TRUE;
+		fprintf(out, "%s\n    { \"bit\": %d, \"attr\": %d, \"attr_bit\": %d, \"ones\": %.3f, \"skewed\": %s }",
+		        i == 0 ? "" : ",", i, cv[i].att, cv[i].bit, ones, skew ? "true" : "false");
+	}
+	fprintf(out, "\n  ],\n");
+
+	fprintf(out, "  \"skewed_attrs\": [");
+	first = TRUE;
+	for (Count a = 0; a < nattrs(r); a++) {
+		if (!skewed[a]) continue;
+		fprintf(out, "%s%d", first ? " " : ", ", a);
+		first = FALSE;
+	}
+	fprintf(out, "%s]\n}\n", first ? "" : " ");
+}
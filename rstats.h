@@ -0,0 +1,13 @@
+// rstats.h ... interface to relation distribution statistics
+// part of Multi-attribute Linear-hashed Files
+// See rstats.c for details of the statistics
+
+#ifndef RSTATS_H
+#define RSTATS_H 1
+
+#include "defs.h"
+#include "reln.h"
+
+void relationStatsJSON(Reln r, FILE *out);
+
+#endif
@@ -0,0 +1,407 @@
+// schema.c ... typed attributes
+// part of Multi-attribute Linear-hashed Files
+// Parse schemas, and convert values between text and binary form
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include "defs.h"
+#include "schema.h"
+#include "hash.h"
+
+// A relation can be given a schema when it is created (schema= in
+// newRelationOpts()): a type for each attribute, one of
+//   int32, int64    signed integers, in decimal
+//   float64         double precision numbers (not NaN)
+//   char(N)         strings of at most N chars
+//   varchar         strings
+// Tuples still come in and go out as text (comma-separated values),
+// but each value must be of its attribute's type, and pages of a
+// typed relation (the PAGE_TYPED layout; see page.c) hold them in
+// binary form:
+//   int32/int64/float64   4/8/8 bytes (host byte order)
+//   char(N)               N bytes, padded with '\0's
+//   varchar               a length byte, then the chars
+// the fields of a tuple follow one another, with no separators
+// Numbers are hashed in binary form, so "7", "07" and "+7" all
+// choose the same bucket, and compared as numbers; they are turned
+// back into text in a standard form ("7"; floats get the fewest
+// digits that give back the same double)
+
+#define MAXNUMLEN  32     // longest text form of a number
+
+static char *typeNames[NTYPES] = {
+	"text", "int32", "int64", "float64", "char", "varchar"
+};
+
+static Bool parseInt(char *v, Count len, int64_t *x);
+static Bool parseFloat(char *v, Count len, double *x);
+static Count encodeValue(AttrType t, char *v, Count len, char *out);
+static Count intText(int64_t x, char *out);
+static Count floatText(double d, char *out);
+static Count typeWidth(AttrType t);
+static Bool isString(AttrType t);
+
+
+// parse a schema: nattrs ':'-separated type names (see above)
+// into types[]; returns ~OK if it is not valid, or if even
+// the smallest tuple wouldn't fit in MAXTUPLEN bytes
+
+Status parseSchema(char *str, Count nattrs, AttrType *types)
+{
+	char *c = str;
+	Count n = 0, width = 0;
+
+	if (nattrs > MAXATTRS) return ~OK;
+	while (n < nattrs) {
+		Count len = strcspn(c, ":");
+		AttrType t = { TYPE_TEXT, 0 };
+		for (Byte i = TYPE_INT32; i < NTYPES; i++) {
+			Count nl = strlen(typeNames[i]);
+			if (len == nl && strncmp(c, typeNames[i], nl) == 0) t.type = i;
+		}
+		if (t.type == TYPE_CHAR) return ~OK;   // needs a width
+		if (t.type == TYPE_TEXT) {
+			char *end;
+			if (strncmp(c, "char(", 5) != 0) return ~OK;
+			long w = strtol(c + 5, &end, 10);
+			if (end == c + 5 || *end != ')' || end + 1 != c + len
+			    || w < 1 || w >= MAXTUPLEN)
+				return ~OK;
+			t.type = TYPE_CHAR;
+			t.width = w;
+		}
+		types[n++] = t;
+		width += typeWidth(t);
+		c += len;
+		if (*c == '\0') break;
+		c++;
+	}
+	if (n != nattrs || *c != '\0' || width >= MAXTUPLEN) return ~OK;
+	return OK;
+}
+
+// write a schema in the form taken by parseSchema() into buf
+// (MAXSCHEMA bytes)
+
+void schemaString(AttrType *types, Count n, char *buf)
+{
+	char *c = buf;
+	*c = '\0';
+	for (Count i = 0; i < n; i++) {
+		if (i > 0) *c++ = ':';
+		if (types[i].type == TYPE_CHAR)
+			c += sprintf(c, "char(%d)", types[i].width);
+		else
+			c += sprintf(c, "%s", typeNames[types[i].type]);
+	}
+}
+
+// is the len-char value v a value of type t?
+
+Bool typedValue(AttrType t, char *v, Count len)
+{
+	char buf[MAXENCLEN];
+	return t.type == TYPE_TEXT || encodeValue(t, v, len, buf) > 0;
+}
+
+// is v a value of integer type t? if so, set *x to it
+
+Bool typedInt(AttrType t, char *v, int64_t *x)
+{
+	if (t.type != TYPE_INT32 && t.type != TYPE_INT64) return FALSE;
+	if (!parseInt(v, strlen(v), x)) return FALSE;
+	return t.type == TYPE_INT64 || (*x >= INT32_MIN && *x <= INT32_MAX);
+}
+
+// is v a value of numeric type t? if so, set *x to it
+
+Bool typedNumber(AttrType t, char *v, double *x)
+{
+	int64_t n;
+	if (t.type == TYPE_FLOAT64) return parseFloat(v, strlen(v), x);
+	if (!typedInt(t, v, &n)) return FALSE;
+	*x = n;
+	return TRUE;
+}
+
+// do equal values of types a and b always hash alike?
+// (strings do, whatever their type; numbers only if the types match)
+
+Bool hashesAlike(AttrType a, AttrType b)
+{
+	return (isString(a) && isString(b)) || a.type == b.type;
+}
+
+// the hash of a value of type t (with hash function family fn):
+// of its binary form, for numbers; of its chars, for strings
+// (and for values that aren't of the type, such as query patterns)
+
+Bits valueHash(int fn, AttrType t, char *v, Count len)
+{
+	int64_t x;
+	double  d;
+	if (t.type == TYPE_INT32 && parseInt(v, len, &x)
+	    && x >= INT32_MIN && x <= INT32_MAX) {
+		int32_t n = x;
+		return hashValue(fn, (unsigned char *)&n, sizeof(n));
+	}
+	if (t.type == TYPE_INT64 && parseInt(v, len, &x))
+		return hashValue(fn, (unsigned char *)&x, sizeof(x));
+	if (t.type == TYPE_FLOAT64 && parseFloat(v, len, &d)) {
+		if (d == 0) d = 0.0;   // -0 == 0
+		return hashValue(fn, (unsigned char *)&d, sizeof(d));
+	}
+	return hashValue(fn, (unsigned char *)v, len);
+}
+
+// encode tuple t (text) in binary form, into out (MAXENCLEN bytes)
+// returns the #bytes written, or 0 if t doesn't have n values of
+// the right types, or would be too long once turned back into text
+
+Count encodeTuple(AttrType *types, Count n, char *t, char *out)
+{
+	Count size = 0, tlen = 0;
+	char *c = t;
+	for (Count i = 0; i < n; i++) {
+		Count len = strcspn(c, ",");
+		Count k = encodeValue(types[i], c, len, out + size);
+		if (k == 0) return 0;
+		if (isString(types[i]))
+			tlen += len + 1;
+		else {
+			char num[MAXNUMLEN];
+			tlen += fieldText(types[i], out + size, num) + 1;
+		}
+		size += k;
+		c += len;
+		if ((*c == '\0') != (i == n - 1)) return 0;
+		if (*c == ',') c++;
+	}
+	return (tlen <= MAXTUPLEN - 1) ? size : 0;
+}
+
+// turn a tuple encoded by encodeTuple() back into text, into out
+// (MAXTUPLEN bytes); returns the length of the text
+
+Count decodeTuple(AttrType *types, Count n, char *enc, char *out)
+{
+	char *c = out;
+	for (Count i = 0; i < n; i++) {
+		if (i > 0) *c++ = ',';
+		c += fieldText(types[i], enc, c);
+		enc += fieldSize(types[i], enc);
+	}
+	*c = '\0';
+	return c - out;
+}
+
+// #bytes taken by the encoded value of type t at f
+
+Count fieldSize(AttrType t, char *f)
+{
+	if (t.type == TYPE_VARCHAR) return 1 + (Byte)f[0];
+	return typeWidth(t);
+}
+
+// write the encoded value of type t at f as text into out
+// (at least MAXNUMLEN bytes, or longer than the value);
+// returns its length
+
+Count fieldText(AttrType t, char *f, char *out)
+{
+	Count n;
+	switch (t.type) {
+	case TYPE_INT32:
+	case TYPE_INT64:
+		return intText(fieldInt(t, f), out);
+	case TYPE_FLOAT64:
+		return floatText(fieldNumber(t, f), out);
+	case TYPE_CHAR:
+		for (n = 0; n < t.width && f[n] != '\0'; n++) ;
+		memcpy(out, f, n);
+		break;
+	default:
+		n = (Byte)f[0];
+		memcpy(out, f + 1, n);
+		break;
+	}
+	out[n] = '\0';
+	return n;
+}
+
+// the encoded integer (of type int32 or int64) at f
+
+int64_t fieldInt(AttrType t, char *f)
+{
+	if (t.type == TYPE_INT32) {
+		int32_t n;
+		memcpy(&n, f, sizeof(n));
+		return n;
+	}
+	int64_t n;
+	memcpy(&n, f, sizeof(n));
+	return n;
+}
+
+// the encoded number (of any numeric type) at f
+
+double fieldNumber(AttrType t, char *f)
+{
+	if (t.type != TYPE_FLOAT64) return fieldInt(t, f);
+	double d;
+	memcpy(&d, f, sizeof(d));
+	return d;
+}
+
+// is the encoded string (of type char(N) or varchar) at f
+// the len-char value v?
+
+Bool fieldIs(AttrType t, char *f, char *v, Count len)
+{
+	if (t.type == TYPE_VARCHAR)
+		return (Byte)f[0] == len && memcmp(f + 1, v, len) == 0;
+	return len <= t.width && memcmp(f, v, len) == 0
+	       && (len == t.width || f[len] == '\0');
+}
+
+
+
+// parse a len-char decimal integer
+
+static Bool parseInt(char *v, Count len, int64_t *x)
+{
+	char buf[MAXNUMLEN];
+	char *end;
+	if (len == 0 || len >= MAXNUMLEN || isspace((Byte)v[0])) return FALSE;
+	memcpy(buf, v, len);
+	buf[len] = '\0';
+	errno = 0;
+	long long n = strtoll(buf, &end, 10);
+	if (*end != '\0' || errno == ERANGE) return FALSE;
+	*x = n;
+	return TRUE;
+}
+
+// parse a len-char number (not NaN)
+
+static Bool parseFloat(char *v, Count len, double *x)
+{
+	char buf[MAXTUPLEN];
+	char *end;
+	if (len == 0 || len >= MAXTUPLEN || isspace((Byte)v[0])) return FALSE;
+	memcpy(buf, v, len);
+	buf[len] = '\0';
+	*x = strtod(buf, &end);
+	return *end == '\0' && !isnan(*x);
+}
+
+// encode the len-char value v of type t into out
+// returns the #bytes written (0 if v isn't of type t)
+
+static Count encodeValue(AttrType t, char *v, Count len, char *out)
+{
+	int64_t x;
+	double  d;
+	switch (t.type) {
+	case TYPE_INT32: {
+		if (!parseInt(v, len, &x) || x < INT32_MIN || x > INT32_MAX) return 0;
+		int32_t n = x;
+		memcpy(out, &n, sizeof(n));
+		return sizeof(n);
+	}
+	case TYPE_INT64:
+		if (!parseInt(v, len, &x)) return 0;
+		memcpy(out, &x, sizeof(x));
+		return sizeof(x);
+	case TYPE_FLOAT64:
+		if (!parseFloat(v, len, &d)) return 0;
+		memcpy(out, &d, sizeof(d));
+		return sizeof(d);
+	case TYPE_CHAR:
+		if (len > t.width) return 0;
+		memcpy(out, v, len);
+		memset(out + len, 0, t.width - len);
+		return t.width;
+	case TYPE_VARCHAR:
+		if (len > 255) return 0;
+		out[0] = len;
+		memcpy(out + 1, v, len);
+		return len + 1;
+	}
+	return 0;
+}
+
+// write x in decimal into out; returns its length
+// (this is on the path of every tuple a typed scan returns,
+// so it avoids sprintf())
+
+static Count intText(int64_t x, char *out)
+{
+	char buf[MAXNUMLEN];
+	char *c = buf + MAXNUMLEN;
+	uint64_t u = (x < 0) ? -(uint64_t)x : (uint64_t)x;
+	do {
+		*--c = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+	if (x < 0) *--c = '-';
+	Count n = buf + MAXNUMLEN - c;
+	memcpy(out, c, n);
+	out[n] = '\0';
+	return n;
+}
+
+// write d into out with the fewest digits (15 to 17) that give back
+// the same double; returns its length
+// most stored values have only a few decimal places: if d*1e6 is an
+// integer m whose m/1e6 gives back d, then m/1e6 is the decimal that
+// %.15g would print (two 15-digit decimals are further apart than
+// doubles are), so it can be written out as an integer
+
+static Count floatText(double d, char *out)
+{
+	double m = d * 1e6;
+	if (fabs(d) >= 1e-4 && fabs(m) < 1e15 && m == floor(m) && m / 1e6 == d) {
+		Count n = intText((int64_t)m, out);
+		Count neg = (m < 0);
+		char *digits = out + neg;
+		Count nd = n - neg;
+		if (nd <= 6) {   // |d| < 1: 0.000ddd
+			memmove(digits + 8 - nd, digits, nd);
+			memcpy(digits, "0.000000", 8 - nd);
+			nd = 8;
+		}
+		else {
+			memmove(digits + nd - 5, digits + nd - 6, 6);
+			digits[nd - 6] = '.';
+			nd++;
+		}
+		while (digits[nd - 1] == '0') nd--;
+		if (digits[nd - 1] == '.') nd--;
+		digits[nd] = '\0';
+		return neg + nd;
+	}
+	for (int prec = 15; ; prec++) {
+		Count n = sprintf(out, "%.*g", prec, d);
+		if (prec == 17 || strtod(out, NULL) == d) return n;
+	}
+}
+
+// #bytes taken by a value of type t (the least, for varchar)
+
+static Count typeWidth(AttrType t)
+{
+	switch (t.type) {
+	case TYPE_INT32:   return 4;
+	case TYPE_INT64:   return 8;
+	case TYPE_FLOAT64: return 8;
+	case TYPE_CHAR:    return t.width;
+	}
+	return 1;
+}
+
+static Bool isString(AttrType t)
+{
+	return t.type == TYPE_TEXT || t.type == TYPE_CHAR || t.type == TYPE_VARCHAR;
+}
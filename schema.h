@@ -0,0 +1,43 @@
+// schema.h ... interface to typed attributes
+// part of Multi-attribute Linear-hashed Files
+// See schema.c for the types and how their values are stored
+
+#ifndef SCHEMA_H
+#define SCHEMA_H 1
+
+#include "defs.h"
+#include "bits.h"
+
+// attribute types
+#define TYPE_TEXT     0   // untyped (a relation without a schema)
+#define TYPE_INT32    1
+#define TYPE_INT64    2
+#define TYPE_FLOAT64  3
+#define TYPE_CHAR     4   // char(N): N bytes, '\0'-padded
+#define TYPE_VARCHAR  5   // length byte, then the value
+#define NTYPES        6
+
+typedef struct AttrType {
+	Byte   type;      // TYPE_...
+	Byte   width;     // N, for char(N)
+} AttrType;
+
+#define MAXSCHEMA   (MAXATTRS*10)    // longest schema string
+#define MAXENCLEN   (2*MAXTUPLEN)    // longest encoded tuple
+
+Status parseSchema(char *str, Count nattrs, AttrType *types);
+void schemaString(AttrType *types, Count n, char *buf);
+Bool typedValue(AttrType t, char *v, Count len);
+Bool typedInt(AttrType t, char *v, int64_t *x);
+Bool typedNumber(AttrType t, char *v, double *x);
+Bool hashesAlike(AttrType a, AttrType b);
+Bits valueHash(int fn, AttrType t, char *v, Count len);
+Count encodeTuple(AttrType *types, Count n, char *t, char *out);
+Count decodeTuple(AttrType *types, Count n, char *enc, char *out);
+Count fieldSize(AttrType t, char *f);
+Count fieldText(AttrType t, char *f, char *out);
+int64_t fieldInt(AttrType t, char *f);
+double fieldNumber(AttrType t, char *f);
+Bool fieldIs(AttrType t, char *f, char *v, Count len);
+
+#endif
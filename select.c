@@ -10,14 +10,69 @@
 #include "tuple.h"
 #include "bits.h"
 #include "hash.h"
+#include "pageio.h"
+#include "project.h"
+#include "qcache.h"
+#include "arena.h"
+
+// number of upcoming candidate buckets whose primary pages
+// are read asynchronously ahead of the scan
+#define READAHEAD 8
+
+// arena chunk size: room for the readahead pages and the query
+#define SELCHUNK  ((READAHEAD + 4) * PAGESIZE)
+
+// pages read at a time by a sequential scan
+#define SCANRUN   64
+
+// cost of reading a page at random, relative to reading
+// it as part of a sequential run (see choosePlan())
+#define RANDCOST  4
+
+// access plans
+#define PLAN_BUCKETS 0   // candidate buckets, one after another
+#define PLAN_SCAN    1   // data file, then overflow file, front to back
+#define PLAN_AUTO    2   // (plan=auto) whichever costs less
+
+// how a constrained attribute is checked in typed pages
+#define TM_TEXT      0   // as text (the value is turned into text first)
+#define TM_INT       1   // integer equal to qnum[k]
+#define TM_RANGE     2   // number in lo[k]..hi[k] (also float equality)
+#define TM_STRING    3   // string equal to the query value (qnum[k] chars)
 
 /**************************************
 NEW FUNCS
 ***************************************/
 static Bool known_attr(char* s);
+static Bool matches_all(char* s);
+static Bool consMatch(Selection s, Count k, char *v);
+static Bool typedMatch(Selection s, Count k, char *f);
+static void typedSetup(Selection s);
+static Bool pageMayMatch(Selection s, Page p);
 static void setup(Reln r, char* q, Selection new);
+static void candidateRange(Selection s);
+static Bool isCandidate(Selection s, PageID b);
+static PageID nextCandidate(Selection s, PageID bid);
+static void choosePlan(Selection s, int want);
+static Status parseSelOpts(char *opts, int *plan);
+static Bool readNextRun(Selection s);
+static Status nextScanPage(Selection s);
+static void fillReadAhead(Selection s);
+static void startOvflowRead(Selection s);
+static int startPageRead(Selection s, FILE *f, PageID pid, Page *buf);
+static void setCurPage(Selection s, Page p);
+static void releasePage(Selection s, Page p);
+static void loadBucket(Selection s, PageID bid);
 static Status moveToNextPage(Selection s);
-static Status nextMatchTup(Selection s, char **t);
+static Status nextPageMatch(Selection s);
+static Status nextMatchTup(Selection s);
+static Bool rowMatch(Selection s);
+static void normaliseQuery(Selection s, char *key);
+static void startCaching(Selection s, char *q);
+static Bool dropMatch(void *arg, Tuple t);
+static Status findNextMatch(Selection s);
+static char *matchedValue(Selection s, Count a);
+static Count copyMatch(Selection s, Projection p, char *buf);
 
 
 /********************************************************************************
@@ -27,6 +82,55 @@ EDIT - add:
 - curBid - current Bucket/primary page
 - maxBid - maximum Page ID possible given the query hash
 - qvals  - array of substrings of query (to avoid repeated malloc of same stuff)
+- cons   - the attributes the query constrains (qvals[i] is not "?")
+- isRng  - is cons[k] a range "lo..hi"? (then its bounds are lo[k], hi[k])
+- sig    - trigrams that a value must contain to match cons[k]
+           (from the literal parts of the query value; hasSig if any)
+- scan   - cursor over the tuples in curPage
+- codeMatch - in DICT pages, result of matching each constrained attribute's
+             pattern against each dictionary code (0 = not yet tried)
+- ahead  - queue of upcoming candidate buckets whose reads have been started
+- aheadReq - read request (see pageio.h) for each bucket in ahead
+           (-1 if it was read at once, the I/O layer having no request free)
+- aheadBuf - buffer each bucket in ahead is read into
+- ovReq  - read request for the next overflow page in the current bucket
+           (-1 if none, or if it was read at once into ovBuf)
+- lastCand - last candidate bucket added to the queue (NO_PAGE when no more)
+- matchTup - in ROW pages, the last matching tuple (points into curPage)
+- vals   - in ROW pages, the attribute values of matchTup (point into tupbuf)
+- matchIdx - in PAX/DICT pages, the index of the last matching tuple
+- types  - attribute types, if the relation has a schema (typed pages)
+- tmatch - in typed pages, how each constrained attribute is checked
+           (TM_...); numbers and strings are compared in binary form
+- matchEnc - in typed pages, the last matching tuple, still encoded;
+           it is turned into text (rowbuf, then vals) only when its
+           values are wanted, and matchEnc is then NULL
+- snap   - shape of the relation (depth, sp, npages) when the scan started;
+           buckets are chosen using this, even if the relation splits later
+- shared - relation is shared with a writer (see readBucket() in reln.c):
+           each bucket's pages are read together, under its latches, into
+           held[0..nHeld-1], and iHeld is the one being scanned
+- hit    - the relation's cached result for this query, if it was
+           still up to date; tuples come from it (from hitPos on),
+           and no pages are read
+- rec    - if the relation has a cache and there was no hit, the
+           result being recorded; it goes into the cache when the
+           scan reaches the end (NULL if it got too big)
+- plan   - how pages are found: PLAN_BUCKETS visits the candidate buckets
+           (primary page, then overflow chain) one by one; PLAN_SCAN
+           streams the data file and then the overflow file in runs of
+           SCANRUN pages, skipping primary pages of other buckets
+           (see choosePlan(); estBuckets..costScan are its estimates,
+           and firstBid is the first candidate bucket)
+- run    - (PLAN_SCAN) the pages of the current run: nRun of them,
+           from page runStart of the file being read (the overflow
+           file once is_ovflow); iRun is the next one to scan, and
+           the file is read up to page runEnd (ovEnd for overflow)
+- mem    - arena holding the SelectionRep itself, the query values,
+           the match memo and the page buffers (except in shared mode,
+           where readBucket() allocates them); a page buffer goes back
+           to the arena when the scan moves on from it, and the lot is
+           freed by closeSelection()
 
 Note: is_ovflow is kind of redundant but whatever!
 
@@ -37,10 +141,56 @@ struct SelectionRep {
 	Bits        known;        // the known bits = 1, unknown bits = 0
     Page        curPage;          // current page in scan
 	Bool        is_ovflow;        // are we in the overflow pages?
-	Offset      curtupOffset;     // offset of current tuple within page      
+	PageScan    scan;             // position of next tuple within page
     Bits        curBid; 
     Bits        maxBid;
     char**       qvals;           //query values  
+    Count       nCons;            // #constrained attributes
+    Count       cons[MAXATTRS];   // constrained attributes
+    Bool        isRng[MAXATTRS];  // constraint is a numeric range
+    double      lo[MAXATTRS];
+    double      hi[MAXATTRS];
+    Bool        hasSig[MAXATTRS]; // constraint has literal trigrams
+    Byte        sig[MAXATTRS][SIGBYTES];
+    Byte        (*codeMatch)[MAXDICT]; // [nCons][MAXDICT] match memo
+    PageID      ahead[READAHEAD]; // readahead queue of candidate buckets
+    int         aheadReq[READAHEAD];
+    Page        aheadBuf[READAHEAD];
+    int         ovReq;            // read of next overflow page
+    Page        ovBuf;
+    Count       headAhead;        // index of first entry in queue
+    Count       nAhead;           // #entries in queue
+    PageID      lastCand;         // last candidate bucket queued
+    Tuple       matchTup;         // last match (ROW pages)
+    char*       vals[MAXATTRS];   // its attribute values
+    char        tupbuf[MAXTUPLEN];
+    Count       matchIdx;         // last match (PAX/DICT pages)
+    AttrType*   types;            // attribute types (NULL if none)
+    Byte        tmatch[MAXATTRS]; // how cons[k] is checked (typed pages)
+    int64_t     qnum[MAXATTRS];
+    char*       matchEnc;         // last match, encoded (typed pages)
+    char        rowbuf[MAXTUPLEN]; // ... and as text
+    RelnSnapshot snap;            // relation shape at start of scan
+    Bool        shared;           // concurrent writer possible
+    Page*       held;             // pages of current bucket (shared)
+    Count       nHeld;
+    Count       iHeld;
+    QResult     hit;              // cached result being returned
+    size_t      hitPos;
+    QResult     rec;              // result being recorded
+    int         plan;             // PLAN_BUCKETS or PLAN_SCAN
+    PageID      firstBid;         // first candidate bucket
+    PageID      estBuckets;       // planner's estimates
+    double      estChain;
+    double      costBuckets;
+    double      costScan;
+    Page        run;              // current run of pages (PLAN_SCAN)
+    Count       nRun;
+    Count       iRun;
+    PageID      runStart;
+    PageID      runEnd;
+    PageID      ovEnd;
+    Arena       mem;              // memory for the scan
 };
 
 
@@ -51,13 +201,29 @@ NEW FUNCTION
  - if known or unknown attribute
 *****************************************/
 static Bool known_attr(char* s) {
-	if (((s[0] == '?') && (s[1] == '\0')) || (strchr(s, '%') != NULL)) 
+	double lo, hi;
+	if (((s[0] == '?') && (s[1] == '\0')) || (strchr(s, '%') != NULL)
+	    || isRange(s, &lo, &hi)) 
 		return FALSE;
 	else return TRUE;
 }
 
 
 
+/****************************************
+NEW FUNCTION 
+ - check if an attribute from query string
+ - matches every value ("?", or a pattern of only '%'s)
+*****************************************/
+static Bool matches_all(char* s) {
+    if ((s[0] == '?') && (s[1] == '\0')) return TRUE;
+    if (s[0] == '\0') return FALSE;
+    for (; *s != '\0'; s++) if (*s != '%') return FALSE;
+    return TRUE;
+}
+
+
+
 /******************************************
 NEW FUNC 
 - given a new, blank selection
@@ -72,11 +238,13 @@ static void setup(Reln r, char * q, Selection new) {
     //char buf[MAXBITS+50];  //*** for debug
 
     new->rel = r;
+    relnSnapshot(r, &new->snap);
 
     
     Count nvals = nattrs(r);
-    new->qvals = (char **) malloc(sizeof(char *) * nvals);
-    tupleVals(q, new->qvals);
+    new->qvals = arenaAlloc(new->mem, nvals * sizeof(char *));
+    for (Count n = splitTuple(arenaString(new->mem, q), new->qvals, nvals); n < nvals; n++)
+        new->qvals[n] = "?";
 
     ChVecItem * cv = chvec(r);
     
@@ -86,12 +254,39 @@ static void setup(Reln r, char * q, Selection new) {
 		// if the attribute is unknown
         // set unknown bits to 1 (in unknown)
 		if (known_attr(new->qvals[i]) == FALSE) {
-			for (int j = 0; j <= MAXCHVEC; j ++)  {
+			for (int j = 0; j < MAXCHVEC; j ++)  {
                 if (cv[j].att == i) unknown = setBit(unknown, j);
             }
 		}
 	}
 
+    // attributes that need to be checked in each tuple
+    new->nCons = 0;
+    for (int i = 0; i < nvals; i ++) {
+        if (matches_all(new->qvals[i]) == FALSE) {
+            Count k = new->nCons++;
+            new->cons[k] = i;
+            new->isRng[k] = isRange(new->qvals[i], &new->lo[k], &new->hi[k]);
+
+            // trigrams of each literal part (between '%'s)
+            memset(new->sig[k], 0, SIGBYTES);
+            new->hasSig[k] = FALSE;
+            if (new->isRng[k]) continue;
+            for (char *c = new->qvals[i]; *c != '\0'; ) {
+                char *c0 = c;
+                while (*c != '%' && *c != '\0') c++;
+                if (c - c0 >= 3) {
+                    ngramSig(c0, c - c0, new->sig[k]);
+                    new->hasSig[k] = TRUE;
+                }
+                if (*c == '%') c++;
+            }
+        }
+    }
+
+    new->codeMatch = arenaAlloc(new->mem, new->nCons * sizeof(*new->codeMatch) + 1);
+    typedSetup(new);
+
     // reverse to get known bits
     new->known = ~unknown;
 
@@ -103,6 +298,409 @@ static void setup(Reln r, char * q, Selection new) {
 
 
 
+/*****************************************************
+NEW FUNC
+    - (typed relations) decide how each constrained attribute
+      is checked in typed pages: an integer or float value, or
+      a range, of a numeric attribute is compared as a number;
+      a plain string value of a string attribute byte by byte;
+      anything else (patterns, values not of the attribute's
+      type) as text
+******************************************************/
+static void typedSetup(Selection s) {
+
+    s->types = attrTypes(s->rel);
+    s->matchEnc = NULL;
+    if (s->types == NULL) return;
+    for (Count k = 0; k < s->nCons; k++) {
+        AttrType t = s->types[s->cons[k]];
+        char*   qv = s->qvals[s->cons[k]];
+        Bool    string = (t.type == TYPE_CHAR || t.type == TYPE_VARCHAR);
+        double  x;
+        s->tmatch[k] = TM_TEXT;
+        if (s->isRng[k]) {
+            if (!string) s->tmatch[k] = TM_RANGE;
+        }
+        else if (strchr(qv, '%') != NULL)
+            continue;
+        else if (typedInt(t, qv, &s->qnum[k]))
+            s->tmatch[k] = TM_INT;
+        else if (t.type == TYPE_FLOAT64 && typedNumber(t, qv, &x)) {
+            s->lo[k] = s->hi[k] = x;
+            s->tmatch[k] = TM_RANGE;
+        }
+        else if (string) {
+            s->qnum[k] = strlen(qv);
+            s->tmatch[k] = TM_STRING;
+        }
+        // signatures hold the trigrams of the stored text form,
+        // which only a text match (not "07" == 7) can rely on
+        if (s->tmatch[k] != TM_TEXT) s->hasSig[k] = FALSE;
+    }
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - set curBid to the first bucket to scan, and maxBid to
+      the last one that could hold matching tuples
+******************************************************/
+static void candidateRange(Selection s) {
+
+    Count d = s->snap.depth;
+    if (d == 0) {
+        s->curBid = 0;
+        s->maxBid = 0;
+    } else {
+        // get the minimum matching page ID (set all unknown bits within lowest depth bits in query hash to 0)
+        s->curBid = getLower(s->qHash, d);
+        //change all unknown bits in query hash to 1 to get maximum (possible) Pid (within lowest depth + 1 bits)
+        s->maxBid = getLower((s->qHash|~(s->known)), 1 + d);  
+        if (s->maxBid >= s->snap.npages) s->maxBid = s->snap.npages - 1;
+    }
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - could bucket b (<= maxBid) hold matching tuples?
+******************************************************/
+static Bool isCandidate(Selection s, PageID b) {
+
+    Count d = s->snap.depth;
+    if (d == 0) return TRUE;    // only bucket 0
+
+    /*  masked bid:
+            s->known: all bits = 1 except unknown bits = 0
+            bid & known: all bits remain the same, but bits at unknown position turn to 0
+        Then: compare with queryHash: use mask_bid XOR queryHash (0 = matched)
+        IF (1) all (depth + 1) bits matched 
+        OR (2) only lowest (depth) bits match, but the page is split pointer or after
+            => grab the page
+    */
+    Bits masked = ((s->known) & b)^(s->qHash);
+
+    return (getLower(masked, d +1 ) == 0) || ( (b >= s->snap.sp) &&  (getLower(masked, d) == 0) );
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - find the next bucket after bid that could hold matching tuples
+    - return NO_PAGE if there is none
+******************************************************/
+static PageID nextCandidate(Selection s, PageID bid) {
+
+    for (PageID b = bid + 1; b <= s->maxBid; b++) {
+        if (isCandidate(s, b)) return b;
+    }
+    return NO_PAGE;
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - estimate the cost of each plan, and choose one
+      (want is PLAN_AUTO, or the plan to use)
+    - a hash bit from a known attribute halves the buckets
+      to visit, so with k of them among the lowest depth bits,
+      about npages/2^k buckets are candidates; each has, on
+      average, as many overflow pages as the overflow file
+      has pages per bucket
+    - PLAN_BUCKETS reads each of those pages at random (RANDCOST
+      each); PLAN_SCAN reads every page of both files in order
+    - in shared mode, buckets must be read under their latches,
+      so PLAN_BUCKETS is always used
+******************************************************/
+static void choosePlan(Selection s, int want) {
+
+    Count   d = s->snap.depth;
+    PageID  np = s->snap.npages;
+    Count   k = (d == 0) ? 0 : __builtin_popcountll(getLower(s->known, d));
+
+    s->ovEnd = novflow(s->rel);
+    s->estBuckets = (np + ((PageID)1 << k) - 1) >> k;
+    s->estChain = (double)s->ovEnd / np;
+    s->costBuckets = s->estBuckets * (1 + s->estChain) * RANDCOST;
+    s->costScan = np + s->ovEnd;
+
+    if (want == PLAN_AUTO)
+        want = (s->costScan < s->costBuckets) ? PLAN_SCAN : PLAN_BUCKETS;
+    s->plan = s->shared ? PLAN_BUCKETS : want;
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - parse the options string given to startSelectionOpts()
+******************************************************/
+static Status parseSelOpts(char *opts, int *plan) {
+
+    char    buf[MAXERRMSG];
+    char    *c, *key, *val, *save;
+
+    *plan = PLAN_AUTO;
+    if (opts == NULL) return OK;
+    if (strlen(opts) >= MAXERRMSG) {
+        printf("Selection options too long\n");
+        return ~OK;
+    }
+    strcpy(buf, opts);
+    for (c = strtok_r(buf, ",", &save); c != NULL; c = strtok_r(NULL, ",", &save)) {
+        key = c;
+        val = strchr(c, '=');
+        if (val == NULL) {
+            printf("Invalid selection option: %s\n", c);
+            return ~OK;
+        }
+        *val++ = '\0';
+        if (strcmp(key, "plan") == 0 && strcmp(val, "auto") == 0)
+            *plan = PLAN_AUTO;
+        else if (strcmp(key, "plan") == 0 && strcmp(val, "buckets") == 0)
+            *plan = PLAN_BUCKETS;
+        else if (strcmp(key, "plan") == 0 && strcmp(val, "scan") == 0)
+            *plan = PLAN_SCAN;
+        else {
+            printf("Unknown selection option: %s=%s\n", key, val);
+            return ~OK;
+        }
+    }
+    return OK;
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - (PLAN_SCAN) read the next run of pages into s->run
+    - when the data file is done (up to the last candidate
+      bucket), carry on with the overflow file from its start
+    - return FALSE when both files are done
+    - the kernel is asked to start on the run after this one,
+      so that reading it overlaps with matching this one
+******************************************************/
+static Bool readNextRun(Selection s) {
+
+    PageID  next = s->runStart + s->nRun;
+    FILE    *f;
+
+    for (;;) {
+        f = s->is_ovflow ? ovflowFile(s->rel) : dataFile(s->rel);
+        if (next < s->runEnd) {
+            Count n = (s->runEnd - next < SCANRUN) ? s->runEnd - next : SCANRUN;
+            n = readRun(pageIO(s->rel), f, next, n, s->run);
+            if (n > 0) {
+                s->runStart = next;
+                s->nRun = n;
+                s->iRun = 0;
+                break;
+            }
+        }
+        if (s->is_ovflow) return FALSE;
+        s->is_ovflow = TRUE;
+        s->runEnd = s->ovEnd;
+        next = 0;
+    }
+
+    next += s->nRun;
+    if (next < s->runEnd)
+        prefetchPages(f, next, (s->runEnd - next < SCANRUN) ? s->runEnd - next : SCANRUN);
+    return TRUE;
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - (PLAN_SCAN) make the next page of the scan current
+    - primary pages of buckets that can't hold matches are
+      skipped; all overflow pages are scanned (those of other
+      buckets hold no matches, but they are only known to belong
+      to another bucket by following chains; their tuples are
+      ruled out when they are matched, and free pages are empty)
+    - return OK, or -1 at the end of the scan
+******************************************************/
+static Status nextScanPage(Selection s) {
+
+    for (;;) {
+        if (s->iRun >= s->nRun && !readNextRun(s)) return -1;
+        PageID pid = s->runStart + s->iRun;
+        Page p = (Page)((char *)s->run + (size_t)s->iRun * PAGESIZE);
+        s->iRun++;
+        if (!s->is_ovflow && !isCandidate(s, pid)) continue;
+        setCurPage(s, p);
+        return OK;
+    }
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - top up the readahead queue with upcoming candidate buckets
+    - and start reading their primary pages
+      so that reading them overlaps with matching the current page
+******************************************************/
+static void fillReadAhead(Selection s) {
+
+    while (s->nAhead < READAHEAD && s->lastCand != NO_PAGE) {
+        s->lastCand = nextCandidate(s, s->lastCand);
+        if (s->lastCand == NO_PAGE) break;
+        Count i = (s->headAhead + s->nAhead) % READAHEAD;
+        s->ahead[i] = s->lastCand;
+        s->aheadReq[i] = startPageRead(s, dataFile(s->rel), s->lastCand, &s->aheadBuf[i]);
+        s->nAhead++;
+    }
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - start reading the current page's overflow successor (if any)
+******************************************************/
+static void startOvflowRead(Selection s) {
+
+    PageID ovf = pageOvflow(s->curPage);
+    s->ovReq = (ovf == NO_PAGE) ? -1
+             : startPageRead(s, ovflowFile(s->rel), ovf, &s->ovBuf);
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - start reading page pid of file f into a new buffer (*buf)
+    - the I/O layer has QDEPTH requests for all the scans on the
+      relation; if none is free, the page is read now instead
+    - return the read request, or -1 if *buf already holds the page
+******************************************************/
+static int startPageRead(Selection s, FILE *f, PageID pid, Page *buf) {
+
+    *buf = arenaPage(s->mem);
+    int req = startReadInto(pageIO(s->rel), f, pid, *buf);
+    if (req < 0) readPage(f, pid, *buf);
+    return req;
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - does value v satisfy the k'th constraint of the query?
+******************************************************/
+static Bool consMatch(Selection s, Count k, char *v) {
+
+    if (s->isRng[k]) return rangeMatch(v, s->lo[k], s->hi[k]);
+    return attrMatch(s->qvals[s->cons[k]], v);
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - (typed pages) does the encoded value at f satisfy
+      the k'th constraint of the query?
+******************************************************/
+static Bool typedMatch(Selection s, Count k, char *f) {
+
+    AttrType t = s->types[s->cons[k]];
+    switch (s->tmatch[k]) {
+    case TM_INT:
+        return fieldInt(t, f) == s->qnum[k];
+    case TM_RANGE: {
+        double x = fieldNumber(t, f);
+        return x >= s->lo[k] && x <= s->hi[k];
+    }
+    case TM_STRING:
+        return fieldIs(t, f, s->qvals[s->cons[k]], s->qnum[k]);
+    }
+    char v[MAXTUPLEN];
+    fieldText(t, f, v);
+    return consMatch(s, k, v);
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - could page p hold a matching tuple?
+    - FALSE if its zone map puts any ranged attribute
+      outside the query's range, or if its n-gram signatures
+      lack some trigram of a constrained attribute
+******************************************************/
+static Bool pageMayMatch(Selection s, Page p) {
+
+    if (pageZones(p) == 0 && pageSigs(p) == 0) return TRUE;
+    for (Count k = 0; k < s->nCons; k++) {
+        if (s->isRng[k] && !pageMayHold(p, s->cons[k], s->lo[k], s->hi[k]))
+            return FALSE;
+        if (s->hasSig[k] && !pageMayContain(p, s->cons[k], s->sig[k]))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - make p the page being scanned
+    - a page that can't hold a match is skipped
+      (its scan starts at the end) without looking at its tuples,
+      or even finding their delimiters
+******************************************************/
+static void setCurPage(Selection s, Page p) {
+
+    s->curPage = p;
+    if (!pageMayMatch(s, p)) {
+        s->scan.next = pageNTuples(p);
+        return;
+    }
+    startPageScan(p, &s->scan);
+    if (pageLayout(p) == PAGE_DICT)
+        memset(s->codeMatch, 0, s->nCons * sizeof(*s->codeMatch));
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - the scan is done with page p: give its buffer back
+      (to the arena, or to free() if readBucket() made it;
+      pages of a sequential scan's run are just overwritten)
+******************************************************/
+static void releasePage(Selection s, Page p) {
+
+    if (s->plan == PLAN_SCAN) return;   // part of s->run
+    if (s->shared) free(p);
+    else arenaFreePage(s->mem, p);
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - (shared mode) read all pages of bucket bid, and
+    - make its primary page the page being scanned
+******************************************************/
+static void loadBucket(Selection s, PageID bid) {
+
+    free(s->held);
+    s->nHeld = readBucket(s->rel, &s->snap, bid, &s->held);
+    s->iHeld = 0;
+    s->curBid = bid;
+    setCurPage(s, s->held[0]);
+    s->is_ovflow = FALSE;
+}
+
+
+
 /*****************************************************
 NEW FUNC
     - Move to selection object to the next MATCHING page 
@@ -115,40 +713,61 @@ Note: make sure curPage != NULL
 static Status moveToNextPage(Selection s) {
 
     Status succeed = -1;
+
+    // a cached result has no pages
+    if (s->hit != NULL) return -1;
+
     PageID next_ovf = pageOvflow(s->curPage);
 
+    // shared: the rest of the bucket is already in memory
+    if (s->shared) {
+        if (s->iHeld + 1 < s->nHeld) {
+            releasePage(s, s->curPage);
+            setCurPage(s, s->held[++s->iHeld]);
+            s->is_ovflow = TRUE;
+            return OK;
+        }
+        PageID bid = nextCandidate(s, s->curBid);
+        if (bid == NO_PAGE) return -1;
+        releasePage(s, s->curPage);
+        loadBucket(s, bid);
+        return OK;
+    }
+
+    // sequential scan: next page of the run
+    if (s->plan == PLAN_SCAN) {
+        succeed = nextScanPage(s);
+    } else if (next_ovf!= NO_PAGE) {
     // if there is at least one more overflow page in the same bucket
-    if (next_ovf!= NO_PAGE) {
-        free(s->curPage);
-        s->curPage = getPage(ovflowFile(s->rel), next_ovf);
-        s->curtupOffset = 0;
+        releasePage(s, s->curPage);
+        if (s->ovReq >= 0) finishRead(pageIO(s->rel), s->ovReq);
+        setCurPage(s, s->ovBuf);
         s->is_ovflow = TRUE;
         succeed = OK;
-    } else {
+    } else if (s->nAhead > 0) {
     // if there is no overflow 
-    // then move to the next MATCHING BUCKET
-        for (int bid = s->curBid + 1; bid <= s->maxBid; bid++) {
-            /*  masked bid:
-                    s->known: all bits = 1 except unknown bits = 0
-                    bid & known: all bits remain the same, but bits at unknown position turn to 0
-                Then: compare with queryHash: use mask_bid XOR queryHash (0 = matched)
-                IF (1) all (depth + 1) bits matched 
-                OR (2) only lowest (depth) bits match, but the page is split pointer or after
-                    => grab the page
-            */
-            Bits masked = ((s->known) & bid)^(s->qHash);
-            Count d = depth(s->rel);
-
-            if ( (getLower(masked, d +1 ) == 0) || ( (bid >= splitp(s->rel)) &&  (getLower(masked, d) == 0) ) ) {
-                if (s->curPage != NULL) free(s->curPage);
-                s->curBid = bid;
-                s->curPage = getPage(dataFile(s->rel), bid);
-                s->curtupOffset = 0;
-                s->is_ovflow = FALSE;
-                succeed = OK;
-                break;
-           }
-        }
+    // then move to the next MATCHING BUCKET (head of readahead queue)
+        PageID bid = s->ahead[s->headAhead];
+        int req = s->aheadReq[s->headAhead];
+        Page buf = s->aheadBuf[s->headAhead];
+        s->headAhead = (s->headAhead + 1) % READAHEAD;
+        s->nAhead--;
+        fillReadAhead(s);
+        if (s->curPage != NULL) releasePage(s, s->curPage);
+        s->curBid = bid;
+        if (req >= 0) finishRead(pageIO(s->rel), req);
+        setCurPage(s, buf);
+        s->is_ovflow = FALSE;
+        succeed = OK;
+    }
+
+    // the next overflow page in the chain is now known
+    if (succeed == OK && s->plan == PLAN_BUCKETS) startOvflowRead(s);
+
+    // at the end of the scan, a recorded result is complete
+    if (succeed != OK && s->rec != NULL) {
+        qcacheInsert(relnCache(s->rel), s->rec);
+        s->rec = NULL;
     }
                
     return succeed;
@@ -159,52 +778,239 @@ static Status moveToNextPage(Selection s) {
 
 /*************************************************************************
 NEW FUNC
-- given a query string, a page and a tuple offset
-- get the next matching tuple in the page
-- and update the offset within in the page
-- IF there is a matching tuple within the page: copy it to t + return OK
-- if there is no matching tup within the page: *t == NULL +  return -1;
+- given a query string, a page and a tuple position (the page scan)
+- find the next matching tuple in the page (see nextMatchTup())
+- and update the position within in the page
+- IF there is a matching tuple within the page: record it + return OK
+  (its values can then be read with matchedValue())
+- if there is no matching tup within the page: return -1;
+- nothing is copied out of the page here
+- in ROW pages, each tuple is split into values once, and only the
+  constrained attributes are checked
+- in PAX pages, only the constrained attributes' columns are read
+  until a tuple matches
+- in DICT pages, each pattern is only matched once against each
+  distinct value (dictionary code) in the page
+- in typed pages, values are checked in binary form (see typedMatch()),
+  and a matching tuple is only turned into text if asked for
 ***************************************************************************/
-static Status nextMatchTup(Selection s, char **t) {
+static Status nextPageMatch(Selection s) {
 
     Page        p = s->curPage;
     Count       nAttr = nattrs(s->rel);
+    Tuple       tup;
+
 
+    if (pageNTuples(p) == 0) return -1;
 
-    if (p->ntuples == 0) return -1;
+    if (pageLayout(p) == PAGE_TYPED) {
+        char*   f[nAttr];
+        while (pageFields(p, &s->scan, f) > 0) {
+            Bool match = TRUE;
+            for (Count k = 0; k < s->nCons && match == TRUE; k++)
+                match = typedMatch(s, k, f[s->cons[k]]);
+            if (match == TRUE) {
+                s->matchEnc = f[0];
+                return OK;
+            }
+        }
+        return -1;
+    }
 
+    if (pageLayout(p) != PAGE_ROW) {
+        Bool dict = (pageLayout(p) == PAGE_DICT);
+        while (s->scan.next < pageNTuples(p)) {
+            Count i = s->scan.next;
+            Bool match = TRUE;
+            for (Count k = 0; k < s->nCons && match == TRUE; k++) {
+                Count a = s->cons[k];
+                if (dict) {
+                    Byte *m = &s->codeMatch[k][pageCode(p, &s->scan, a, i)];
+                    if (*m == 0)
+                        *m = consMatch(s, k, pageValue(p, &s->scan, a, i)) ? 1 : 2;
+                    match = (*m == 1);
+                }
+                else
+                    match = consMatch(s, k, pageValue(p, &s->scan, a, i));
+            }
+            s->scan.next++;
+            if (match == TRUE) {
+                s->matchIdx = i;
+                return OK;
+            }
+        }
+        return -1;
+    }
 
-    char*       c0 = p->data + s->curtupOffset;
-    char*       c = p->data + s->curtupOffset + 1;
-    char        temp[MAXTUPLEN];
+    while ((tup = nextPageTuple(p, &s->scan, NULL)) != NULL) {
+        //printf("select.c nextMatchTup get tup = "); puts(tup);  //for debug
+        //if it is a match, remember it and stop
+        //(the page scan already knows where its ','s are)
+        pageSplitTuple(p, &s->scan, s->tupbuf, s->vals, nAttr);
+        Bool match = TRUE;
+        for (Count k = 0; k < s->nCons && match == TRUE; k++) {
+            match = consMatch(s, k, s->vals[s->cons[k]]);
+        }
+        if (match == TRUE) {
+            s->matchTup = tup;
+            return OK;
+        }
+    }
     
-   
-    Status succeed = -1;
+    return -1;
+
+}
+
+
+
+/*************************************************************************
+NEW FUNC
+- find the next matching tuple in the current page, as nextPageMatch()
+- with a cache hit, take the next tuple of the cached result instead
+  (treated like a match in a ROW page)
+- while recording a result, add each match to it
+***************************************************************************/
+static Status nextMatchTup(Selection s) {
 
-    while ((c < p->data + p->free) && (succeed != OK)){
-
-        if (*c == '\0') {
-            memcpy(temp, c0, c - c0 + 1);   //this will also copy *c = '\0' at the end
-            //printf("select.c nextMatchTup get tup = "); puts(temp);  //for debug
-            //if it is a match, get the result and stop
-            if (tupValMatch(nAttr, s->qvals, temp) == TRUE) {
-                //copy the result
-                *t = (char*) malloc(sizeof(char)* (c - c0 + 1));
-                memcpy(*t, temp, c - c0 + 1);  //this will also copy *c = '\0' at the end
-                succeed = OK;
-            } 
-            // move the current offset to next tuple          
-            c ++;
-            c0 = c;
-            s->curtupOffset = c0 - p->data;
+    if (s->hit != NULL) {
+        char *t = qresultTuple(s->hit, &s->hitPos);
+        if (t == NULL) return -1;
+        s->matchTup = t;
+        strcpy(s->tupbuf, t);
+        splitTuple(s->tupbuf, s->vals, nattrs(s->rel));
+        return OK;
+    }
+
+    Status ok = nextPageMatch(s);
+    if (ok == OK && s->rec != NULL) {
+        char    temp[MAXTUPLEN];
+        char*   t;
+        Count   n;
+        if (rowMatch(s)) n = strlen(t = s->matchTup);
+        else n = copyMatch(s, NULL, t = temp);
+        if (qresultAddTuple(s->rec, t, n) != OK) {
+            qresultRelease(s->rec);
+            s->rec = NULL;
         }
+    }
+    return ok;
+}
+
+
 
-        c++;
-             
+/*************************************************************************
+NEW FUNC
+- is the last match a whole tuple string in s->matchTup
+  (ROW pages, typed pages and cached results) rather than a tuple
+  in a PAX/DICT page?
+- a match in a typed page is turned into text here, the first time
+***************************************************************************/
+static Bool rowMatch(Selection s) {
+
+    if (s->hit != NULL) return TRUE;
+    if (pageLayout(s->curPage) != PAGE_TYPED)
+        return pageLayout(s->curPage) == PAGE_ROW;
+    if (s->matchEnc != NULL) {
+        // decode field by field, so s->vals can be set without
+        // searching the text for commas again
+        char *c = s->rowbuf, *f = s->matchEnc;
+        for (Count i = 0; i < nattrs(s->rel); i++) {
+            if (i > 0) *c++ = ',';
+            s->vals[i] = s->tupbuf + (c - s->rowbuf);
+            c += fieldText(s->types[i], f, c);
+            f += fieldSize(s->types[i], f);
+        }
+        *c = '\0';
+        memcpy(s->tupbuf, s->rowbuf, c - s->rowbuf + 1);
+        for (Count i = 1; i < nattrs(s->rel); i++) s->vals[i][-1] = '\0';
+        s->matchTup = s->rowbuf;
+        s->matchEnc = NULL;
     }
-    
-    return succeed;
+    return TRUE;
+}
 
+
+
+/*************************************************************************
+NEW FUNC
+- find the next matching tuple in the scan
+- if there is no matching tuple in s->curPage, move to another page
+- return OK if found, -1 if cannot move anymore
+***************************************************************************/
+static Status findNextMatch(Selection s) {
+
+    Status try = nextMatchTup(s);
+
+    while (try != OK) {
+        if (moveToNextPage(s) != OK) break;
+        try = nextMatchTup(s);
+    }
+    return try;
+}
+
+
+
+/*************************************************************************
+NEW FUNC
+- value of attribute a in the last matching tuple
+- the string belongs to the selection (or its current page)
+***************************************************************************/
+static char *matchedValue(Selection s, Count a) {
+
+    if (rowMatch(s)) return s->vals[a];
+    return pageValue(s->curPage, &s->scan, a, s->matchIdx);
+}
+
+
+
+/*************************************************************************
+NEW FUNC
+- write the query in a standard form into key (at least as long as
+  the query string), so that equivalent queries share a cache entry:
+  values that match everything become "?", and runs of '%' become one
+***************************************************************************/
+static void normaliseQuery(Selection s, char *key) {
+
+    char*   k = key;
+    for (Count i = 0; i < nattrs(s->rel); i++) {
+        char*   v = s->qvals[i];
+        if (i > 0) *k++ = ',';
+        if (matches_all(v)) { *k++ = '?'; continue; }
+        for (; *v != '\0'; v++) {
+            if (*v == '%' && k > key && *(k-1) == '%') continue;
+            *k++ = *v;
+        }
+    }
+    *k = '\0';
+}
+
+
+
+/*************************************************************************
+NEW FUNC
+- (the relation has a result cache) look the query up in it
+- on a hit, the scan returns the cached tuples (s->hit)
+- otherwise start recording the result (s->rec), noting the
+  version of every candidate bucket the scan is going to read
+***************************************************************************/
+static void startCaching(Selection s, char *q) {
+
+    QCache  c = relnCache(s->rel);
+    char    key[strlen(q) + nattrs(s->rel) + 1];
+
+    normaliseQuery(s, key);
+    s->hit = qcacheLookup(c, s->rel, key);
+    s->hitPos = 0;
+    if (s->hit != NULL) return;
+
+    s->rec = newQResult(c, key);
+    for (PageID b = s->curBid; b != NO_PAGE; b = nextCandidate(s, b)) {
+        if (qresultAddBucket(s->rec, b, bucketVersion(s->rel, b)) != OK) {
+            qresultRelease(s->rec);
+            s->rec = NULL;
+            break;
+        }
+    }
 }
 
 
@@ -214,9 +1020,31 @@ static Status nextMatchTup(Selection s, char **t) {
 // set up a SelectionRep object for the scan
 
 Selection startSelection(Reln r, char *q)
-{        
-    Selection new = malloc(sizeof(struct SelectionRep));
-    assert(new != NULL);
+{
+    return startSelectionOpts(r, q, "");
+}
+
+
+
+/*NEW*/
+// as startSelection(), with options
+// opts is a comma-separated list of key=value settings
+//   plan=auto|buckets|scan   how to find the candidate pages:
+//                     visit the candidate buckets one by one, or
+//                     stream the data and overflow files front to
+//                     back; auto picks the cheaper (default: auto)
+//                     (see choosePlan(); explainSelection() shows
+//                     the choice)
+// returns NULL (after saying why) if the options are invalid
+
+Selection startSelectionOpts(Reln r, char *q, char *opts)
+{
+    int want;
+    if (parseSelOpts(opts, &want) != OK) return NULL;
+
+    Arena mem = newArena(SELCHUNK);
+    Selection new = arenaAlloc(mem, sizeof(struct SelectionRep));
+    new->mem = mem;
 
     //set up - record relation
     // and get query hash and known bits (lowest depth+1 bits only)
@@ -224,19 +1052,52 @@ Selection startSelection(Reln r, char *q)
     setup(r, q, new)
 ;    
     // get the first page
-    if (depth(r) == 0) {
-        new->curBid = 0;
-        new->maxBid = 0;
-    } else {
-        // get the minimum matching page ID (set all unknown bits within lowest depth bits in query hash to 0)
-        new->curBid = getLower(new->qHash, depth(r));
-        //change all unknown bits in query hash to 1 to get maximum (possible) Pid (within lowest depth + 1 bits)
-        new->maxBid = getLower((new->qHash|~(new->known)), 1 + depth(r));  
-        if (new->maxBid >= npages(r)) new->maxBid = npages(r) - 1;
+    candidateRange(new);
+    new->firstBid = new->curBid;
+    new->headAhead = new->nAhead = 0;
+    new->ovReq = -1;
+    new->held = NULL;
+    new->nHeld = new->iHeld = 0;
+    new->curPage = NULL;
+    new->hit = new->rec = NULL;
+    new->shared = relnShared(r);
+    new->nRun = new->iRun = 0;
+    new->run = NULL;
+    choosePlan(new, want);
+    if (relnCache(r) != NULL) {
+        startCaching(new, q);
+        if (new->hit != NULL) {
+            new->lastCand = NO_PAGE;
+            return new;
+        }
     }
-    new->curPage = getPage(dataFile(r), new->curBid);
-    new->curtupOffset = 0; 
+    if (new->shared) {
+        // no readahead: pages must be read under the bucket's latches
+        loadBucket(new, new->curBid);
+        return new;
+    }
+    if (new->plan == PLAN_SCAN) {
+        // from the first candidate bucket to the last
+        // (tuples don't belong to any one bucket as they are found)
+        new->lastCand = NO_PAGE;
+        new->run = arenaPages(new->mem, SCANRUN);
+        new->runStart = new->curBid;
+        new->runEnd = new->maxBid + 1;
+        new->curBid = NO_PAGE;
+        new->is_ovflow = FALSE;
+        nextScanPage(new);
+        return new;
+    }
+
+    // queue up and hint the candidate buckets after the first one
+    new->lastCand = new->curBid;
+    fillReadAhead(new);
+
+    Page p = arenaPage(new->mem);
+    readPage(dataFile(r), new->curBid, p);
+    setCurPage(new, p);
     new->is_ovflow = FALSE;
+    startOvflowRead(new);
 
 
     /*
@@ -259,6 +1120,37 @@ Selection startSelection(Reln r, char *q)
 
 
 
+/*************************************************************************
+NEW FUNC
+- write the last matching tuple into buf
+- only its projected attributes if p != NULL
+- return the length of the string written
+***************************************************************************/
+static Count copyMatch(Selection s, Projection p, char *buf) {
+
+    Bool    row = rowMatch(s);
+
+    if (row && (p == NULL || projectsAll(p))) {
+        Count n = strlen(s->matchTup);
+        memcpy(buf, s->matchTup, n + 1);
+        return n;
+    }
+
+    Count   nv = (p == NULL) ? nattrs(s->rel) : projectionSize(p);
+    char*   c = buf;
+    for (Count i = 0; i < nv; i++) {
+        char*   v = matchedValue(s, (p == NULL) ? i : projectedAttr(p, i));
+        Count   n = strlen(v);
+        memcpy(c, v, n);
+        c += n;
+        *c++ = ',';
+    }
+    *(c-1) = '\0';
+    return (c-1) - buf;
+}
+
+
+
 /********************************************
 EDIT - return next matching tuple during a scan
 - if there is no matching tuple in s->curPage
@@ -269,26 +1161,205 @@ EDIT - return next matching tuple during a scan
 
 Tuple getNextTuple(Selection s)
 {
-    char* t = NULL;
-    Status try = nextMatchTup(s, &t);
-    
+    if (findNextMatch(s) != OK) return NULL;
+
     //if (try == OK) printf("select.c getNextTuple found a match tup = '%s' \n", t); //for debug
 
-    while (try != OK) {
-        
-        Status move = moveToNextPage(s);
+    if (rowMatch(s)) return copyString(s->matchTup);
+
+    char    temp[MAXTUPLEN];
+    copyMatch(s, NULL, temp);
+    return copyString(temp);
+}
+
+
+
+/********************************************
+NEW FUNC - fused selection and projection
+- find the next matching tuple during a scan
+- and write only its projected attributes into buf
+  (no copy of the whole tuple is made)
+- for a DISTINCT projection, rows already given are skipped,
+  and rows put aside in spilled partitions (see distinctRow()
+  in project.c) are given once the scan is over
+- return TRUE if a tuple was found, FALSE at the end of the scan
+**********************************************/
 
-        if (move == OK) {
-            // printf("select.c getNextTuple move successfully to bid = %u \n", s->curBid);  // for debug
-            try = nextMatchTup(s, &t);
+Bool getNextProjected(Selection s, Projection p, char *buf)
+{
+    if (!projectionDistinct(p)) {
+        if (findNextMatch(s) != OK) return FALSE;
+        copyMatch(s, p, buf);
+        return TRUE;
+    }
+    while (findNextMatch(s) == OK) {
+        Count n = copyMatch(s, p, buf);
+        if (distinctRow(p, &s->snap, s->curBid, buf, n)) return TRUE;
+    }
+    return nextSpilledRow(p, buf);
+}
+
+
+
+/********************************************
+NEW FUNC - batch cursor
+- refill the (caller's) batch b with the next matching tuples
+- matching runs over each page in a tight loop, and carries
+  on into following pages until the batch is full
+- return the number of tuples in the batch (0 at the end of the scan)
+**********************************************/
+
+Count getNextBatch(Selection s, TupleBatch *b)
+{
+    clearTupleBatch(b);
+
+    while (b->ntuples < b->max) {
+        while (b->ntuples < b->max && nextMatchTup(s) == OK) {
+            batchAdd(b, copyMatch(s, NULL, batchSpace(b)));
+        }
+        if (b->ntuples < b->max && moveToNextPage(s) != OK) break;
+    }
+    return b->ntuples;
+}
+
+
+
+/********************************************
+NEW FUNC - count the (remaining) matching tuples in a scan
+- nothing is copied out of the pages
+- if the query constrains no attribute (e.g. "?,?,?"), every
+  tuple in a candidate page matches, so only the page headers
+  are looked at
+- the scan is finished afterwards
+**********************************************/
+
+uint64_t countMatches(Selection s)
+{
+    uint64_t n = 0;
+
+    if (s->hit != NULL) {
+        while (nextMatchTup(s) == OK) n++;
+        return n;
+    }
+    // not worth recording: counting these is already cheap
+    if (s->nCons == 0 && s->rec != NULL) {
+        qresultRelease(s->rec);
+        s->rec = NULL;
+    }
+
+    do {
+        Page p = s->curPage;
+        if (s->nCons == 0) {
+            n += pageNTuples(p) - s->scan.next;
+            s->scan.next = pageNTuples(p);
         } else {
-            // printf("select.c getNextTuple cannot move from bid = %u \n", s->curBid); // for debug
-            break;
+            while (nextMatchTup(s) == OK) n++;
         }
+    } while (moveToNextPage(s) == OK);
 
+    return n;
+}
+
+
+
+/********************************************
+NEW FUNC - delete the tuples matching query q
+- each candidate bucket is read, and the tuples that don't
+  match are packed back into it (see deleteFromBucket())
+- if that leaves the relation under-full, buckets are merged
+  (see shrinkRelation()), so no Selection on the relation
+  should be open
+- not through a concurrent=on handle
+- returns the number of tuples deleted
+**********************************************/
+
+uint64_t deleteFromRelation(Reln r, char *q)
+{
+    struct SelectionRep s;
+    uint64_t n = 0;
+
+    if (relnShared(r)) {
+        printf("Can't delete through a concurrent=on handle\n");
+        return 0;
     }
-    
-    return t;
+    s.mem = newArena(SELCHUNK);
+    setup(r, q, &s);
+    candidateRange(&s);
+    for (PageID b = s.curBid; b != NO_PAGE; b = nextCandidate(&s, b))
+        n += deleteFromBucket(r, b, dropMatch, &s);
+    countAllocs(r, s.mem);
+    freeArena(s.mem);
+
+    if (n > 0) shrinkRelation(r);
+    return n;
+}
+
+
+
+/*****************************************************
+NEW FUNC
+    - does tuple t match the query of Selection arg?
+      (for deleteFromBucket())
+******************************************************/
+static Bool dropMatch(void *arg, Tuple t) {
+
+    Selection s = arg;
+    if (s->types != NULL) {
+        // as a typed page would check it (see nextPageMatch())
+        Count   n = nattrs(s->rel);
+        char    enc[MAXENCLEN];
+        char*   f[n];
+        if (encodeTuple(s->types, n, t, enc) == 0) return FALSE;
+        f[0] = enc;
+        for (Count a = 1; a < n; a++) f[a] = f[a-1] + fieldSize(s->types[a-1], f[a-1]);
+        for (Count k = 0; k < s->nCons; k++)
+            if (!typedMatch(s, k, f[s->cons[k]])) return FALSE;
+        return TRUE;
+    }
+    strcpy(s->tupbuf, t);
+    splitTuple(s->tupbuf, s->vals, nattrs(s->rel));
+    for (Count k = 0; k < s->nCons; k++)
+        if (!consMatch(s, k, s->vals[s->cons[k]])) return FALSE;
+    return TRUE;
+}
+
+
+
+// the bucket the last tuple returned came from (NO_PAGE if the
+// scan doesn't go bucket by bucket), and
+// the relation's shape when the scan started
+PageID selectionBucket(Selection s) { return s->curBid; }
+Bool selectionByBucket(Selection s) { return s->hit == NULL && s->plan == PLAN_BUCKETS; }
+RelnSnapshot *selectionSnapshot(Selection s) { return &s->snap; }
+
+
+
+/********************************************
+NEW FUNC - describe how the scan finds its tuples
+- the plan chosen (see choosePlan()), and the estimates
+  it was chosen on, as lines of text in buf (of size n)
+- returns the length of the description (as snprintf)
+**********************************************/
+
+Count explainSelection(Selection s, char *buf, Count n)
+{
+    char    *plan;
+
+    if (s->hit != NULL)
+        plan = "cached result";
+    else if (s->plan == PLAN_SCAN)
+        plan = "sequential scan of data and overflow files";
+    else
+        plan = "candidate buckets";
+
+    return snprintf(buf, n,
+        "Plan: %s\n"
+        "Candidate buckets: ~%"PRIu64" of %"PRIu64" (%"PRIu64"..%"PRIu64")\n"
+        "Overflow pages: %"PRIu64" (~%.2f per bucket)\n"
+        "Cost: buckets %.0f, sequential %.0f%s\n",
+        plan, s->estBuckets, s->snap.npages, s->firstBid, s->maxBid,
+        s->ovEnd, s->estChain, s->costBuckets, s->costScan,
+        s->shared ? " (concurrent=on: buckets only)" : "");
 }
 
 
@@ -297,7 +1368,19 @@ Tuple getNextTuple(Selection s)
 // clean up a SelectionRep object and associated data
 void closeSelection(Selection s)
 {
-    if (s->curPage != NULL) free(s->curPage);
-    if (s->qvals != NULL) freeVals(s->qvals, nattrs(s->rel));
-    free(s);
+    // wait for (and discard) any reads still in flight
+    // (their buffers, like the rest of the scan's memory, are in s->mem)
+    PageIO io = pageIO(s->rel);
+    if (s->ovReq >= 0) finishRead(io, s->ovReq);
+    for (Count i = 0; i < s->nAhead; i++) {
+        int req = s->aheadReq[(s->headAhead + i) % READAHEAD];
+        if (req >= 0) finishRead(io, req);
+    }
+    if (s->shared && s->curPage != NULL) free(s->curPage);
+    if (s->hit != NULL) qresultRelease(s->hit);
+    if (s->rec != NULL) qresultRelease(s->rec);
+    for (Count i = s->iHeld + 1; i < s->nHeld; i++) free(s->held[i]);
+    free(s->held);
+    countAllocs(s->rel, s->mem);
+    freeArena(s->mem);
 }
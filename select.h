@@ -11,9 +11,19 @@ typedef struct SelectionRep *Selection;
 
 #include "reln.h"
 #include "tuple.h"
+#include "project.h"
 
 Selection startSelection(Reln, char *);
+Selection startSelectionOpts(Reln, char *, char *);
 Tuple getNextTuple(Selection);
+Bool getNextProjected(Selection, Projection, char *);
+Count getNextBatch(Selection, TupleBatch *);
+uint64_t countMatches(Selection);
+uint64_t deleteFromRelation(Reln, char *);
+PageID selectionBucket(Selection);
+Bool selectionByBucket(Selection);
+Count explainSelection(Selection, char *, Count);
+RelnSnapshot *selectionSnapshot(Selection);
 void closeSelection(Selection);
 
 #endif
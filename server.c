@@ -0,0 +1,589 @@
+// server.c ... long-running server for queries and inserts
+// part of Multi-attribute Linear-hashed Files
+// Usage:  ./server  [-c CacheSize]  SocketPath
+//
+// Relations are opened on first use and stay open (with their
+// query caches, if any) until the server is stopped (SIGINT or
+// SIGTERM), when they are all closed properly
+//
+// Clients connect to a Unix domain socket; each connection gets its
+// own thread, and can send any number of requests, one at a time
+//
+// Every message is a frame: a 4-byte length (network byte order),
+// then that many bytes; requests are text, '\n'-separated:
+//   query\nRelName\nQueryString[\nAttrs[\nOpts]]
+//       matching tuples, projected onto Attrs (default "*"; each
+//       attribute at most once), with projection options Opts
+//       (see startProjectionOpts())
+//   count\nRelName\nQueryString
+//       the number of matching tuples
+//   explain\nRelName\nQueryString
+//       how the query would be run (see explainSelection())
+//   stats\nRelName
+//       statistics on the relation, as JSON (see rstats.c)
+//   advise\nRelName[\nOpts]
+//       a choice vector that would spread the relation's tuples
+//       more evenly, with options Opts (see adviseChVec())
+//   rebuild\nRelName[\nChVec]
+//       copy the relation into one with choice vector ChVec (by
+//       default, the one advised), which then replaces it
+//   insert\nRelName\nTuple\nTuple...
+//       add the tuples to the relation
+// Replies are one or more frames, each starting with a type byte:
+//   'T' some result rows, each ending in '\n' (query only), or
+//       part of an explanation, the statistics or the advice
+//   'K' the request is done; then the number of tuples returned,
+//       counted, inserted or copied (rebuild), in decimal (0 for
+//       explain, stats and advise)
+//   'E' the request failed; then a message
+//
+// Without -c, relations are opened with concurrent=on, and requests
+// on the same relation run at the same time; with -c, each relation
+// keeps a cache of CacheSize bytes of query results (see qcache.c),
+// and requests on it take turns
+//
+// A rebuild lets queries go on while the tuples are copied, but
+// holds up inserts until the new relation has replaced the old one
+
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "defs.h"
+#include "reln.h"
+#include "select.h"
+#include "project.h"
+#include "tuple.h"
+#include "rstats.h"
+#include "cvadvise.h"
+
+#define MAXOPEN     64             // max relations open at once
+#define MAXFRAME    (4<<20)        // longest request
+#define FRAMEDATA   (16<<10)       // result rows per 'T' frame
+
+typedef struct OpenReln {
+	char     name[MAXRELNAME];
+	Reln     rel;
+	pthread_mutex_t lock;          // held during each request (with -c)
+	pthread_rwlock_t writes;       // shared by inserts, held by rebuilds
+	pthread_rwlock_t handle;       // shared while rel is in use,
+	                               // held while a rebuild replaces it
+} OpenReln;
+
+typedef struct Conn {
+	int      fd;
+	Bool     dead;                 // a write to the client failed
+	size_t   used;                 // rows waiting in out[]
+	char     out[FRAMEDATA];
+} Conn;
+
+static char      relOpts[MAXERRMSG];   // openRelationOpts() options
+static Bool      turns;                // requests on a relation take turns
+static OpenReln  rels[MAXOPEN];
+static Count     nrels = 0;
+static pthread_mutex_t relsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int       lsock;                // listening socket
+static Bool      stopping = FALSE;
+static Count     active = 0;           // requests being served
+static pthread_mutex_t stateLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  idle = PTHREAD_COND_INITIALIZER;
+
+static void *client(void *arg);
+static void *waitForSignal(void *arg);
+static void serve(Conn *c, char *req);
+static void doQuery(Conn *c, Reln r, char *q, char *attrs, char *opts);
+static void doInsert(Conn *c, Reln r, char *tuples);
+static void doStats(Conn *c, Reln r);
+static void doAdvise(Conn *c, Reln r, char *opts);
+static void doRebuild(Conn *c, OpenReln *o, char *cv);
+static void sendText(Conn *c, char *text, size_t len);
+static OpenReln *findReln(char *name);
+static Bool validTuple(Reln r, char *t);
+static char *nextLine(char **rest);
+static Bool readFrame(int fd, char **buf);
+static void sendFrame(Conn *c, char type, char *data, size_t len);
+static void addRow(Conn *c, char *row, Count len);
+static void reply(Conn *c, char type, char *fmt, ...);
+static Bool readAll(int fd, void *buf, size_t n);
+static Bool writeAll(int fd, void *buf, size_t n);
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG];
+	char *path;
+	size_t cache = 0;
+
+	if (argc == 4 && strcmp(argv[1], "-c") == 0) {
+		if (parseSize(argv[2], &cache) != 0 || cache == 0) {
+			sprintf(err, "Invalid cache size: %s", argv[2]);
+			fatal(err);
+		}
+		path = argv[3];
+	}
+	else if (argc == 2)
+		path = argv[1];
+	else {
+		sprintf(err, "Usage: %s [-c CacheSize] SocketPath", argv[0]);
+		fatal(err);
+	}
+	if (strlen(path) >= sizeof(((struct sockaddr_un *)0)->sun_path))
+		fatal("Socket path too long");
+	turns = (cache > 0);
+	if (turns)
+		sprintf(relOpts, "cache=%zu", cache);
+	else
+		strcpy(relOpts, "concurrent=on");
+
+	// SIGINT/SIGTERM are only taken by the waitForSignal() thread,
+	// and a client that goes away mustn't kill the server
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);   // left by an old server
+	lsock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lsock < 0 || bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(lsock, 64) < 0) {
+		sprintf(err, "Can't listen on %s", path);
+		fatal(err);
+	}
+
+	pthread_t t;
+	pthread_create(&t, NULL, waitForSignal, &sigs);
+	pthread_detach(t);
+
+	for (;;) {
+		int fd = accept(lsock, NULL, NULL);
+		if (fd < 0) {
+			pthread_mutex_lock(&stateLock);
+			Bool done = stopping;
+			pthread_mutex_unlock(&stateLock);
+			if (done) break;
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			fatal("accept failed");
+		}
+		Conn *c = malloc(sizeof(Conn));
+		assert(c != NULL);
+		c->fd = fd;
+		c->dead = FALSE;
+		c->used = 0;
+		if (pthread_create(&t, NULL, client, c) != 0) {
+			close(fd);
+			free(c);
+			continue;
+		}
+		pthread_detach(t);
+	}
+
+	// let the requests in progress finish, then close everything
+	pthread_mutex_lock(&stateLock);
+	while (active > 0) pthread_cond_wait(&idle, &stateLock);
+	pthread_mutex_unlock(&stateLock);
+	for (Count i = 0; i < nrels; i++) closeRelation(rels[i].rel);
+	close(lsock);
+	unlink(path);
+	return 0;
+}
+
+// serve one client's requests until it disconnects
+
+static void *client(void *arg)
+{
+	Conn *c = arg;
+	char *req;
+
+	while (!c->dead && readFrame(c->fd, &req)) {
+		pthread_mutex_lock(&stateLock);
+		Bool refuse = stopping;
+		if (!refuse) active++;
+		pthread_mutex_unlock(&stateLock);
+		if (refuse)
+			reply(c, 'E', "server is stopping");
+		else {
+			serve(c, req);
+			pthread_mutex_lock(&stateLock);
+			if (--active == 0) pthread_cond_broadcast(&idle);
+			pthread_mutex_unlock(&stateLock);
+		}
+		free(req);
+	}
+	close(c->fd);
+	free(c);
+	return NULL;
+}
+
+// wait for SIGINT/SIGTERM, then stop taking connections
+// (shutdown() wakes up the accept() in main())
+
+static void *waitForSignal(void *arg)
+{
+	int sig;
+	sigwait((sigset_t *)arg, &sig);
+	pthread_mutex_lock(&stateLock);
+	stopping = TRUE;
+	pthread_mutex_unlock(&stateLock);
+	shutdown(lsock, SHUT_RDWR);
+	return NULL;
+}
+
+// carry out one request (see the top of this file)
+
+static void serve(Conn *c, char *req)
+{
+	char *rest = req;
+	char *op = nextLine(&rest);
+	char *name = nextLine(&rest);
+	if (name == NULL) {
+		reply(c, 'E', "missing relation name");
+		return;
+	}
+	Bool isQuery = (strcmp(op, "query") == 0);
+	Bool isCount = (strcmp(op, "count") == 0);
+	Bool isExplain = (strcmp(op, "explain") == 0);
+	Bool isStats = (strcmp(op, "stats") == 0);
+	Bool isAdvise = (strcmp(op, "advise") == 0);
+	Bool isRebuild = (strcmp(op, "rebuild") == 0);
+	Bool isInsert = (strcmp(op, "insert") == 0);
+	if (!isQuery && !isCount && !isExplain && !isStats && !isAdvise
+	    && !isRebuild && !isInsert) {
+		reply(c, 'E', "unknown request: %s", op);
+		return;
+	}
+	OpenReln *o = findReln(name);
+	if (o == NULL) {
+		reply(c, 'E', "can't open relation %s", name);
+		return;
+	}
+
+	if (turns) pthread_mutex_lock(&o->lock);
+	if (isRebuild) {
+		doRebuild(c, o, nextLine(&rest));
+		if (turns) pthread_mutex_unlock(&o->lock);
+		return;
+	}
+	if (isInsert) pthread_rwlock_rdlock(&o->writes);
+	pthread_rwlock_rdlock(&o->handle);
+	if (isQuery || isCount || isExplain) {
+		char *q = nextLine(&rest);
+		char *attrs = nextLine(&rest);
+		char *opts = nextLine(&rest);
+		if (q == NULL || !validTuple(o->rel, q))
+			reply(c, 'E', "invalid query");
+		else if (isQuery)
+			doQuery(c, o->rel, q, attrs == NULL ? "*" : attrs, opts == NULL ? "" : opts);
+		else if (isExplain) {
+			Selection s = startSelection(o->rel, q);
+			Count n = explainSelection(s, c->out, FRAMEDATA);
+			closeSelection(s);
+			sendFrame(c, 'T', c->out, n);
+			reply(c, 'K', "0");
+		}
+		else {
+			Selection s = startSelection(o->rel, q);
+			uint64_t n = countMatches(s);
+			closeSelection(s);
+			reply(c, 'K', "%"PRIu64, n);
+		}
+	}
+	else if (isStats)
+		doStats(c, o->rel);
+	else if (isAdvise)
+		doAdvise(c, o->rel, nextLine(&rest));
+	else
+		doInsert(c, o->rel, rest);
+	pthread_rwlock_unlock(&o->handle);
+	if (isInsert) pthread_rwlock_unlock(&o->writes);
+	if (turns) pthread_mutex_unlock(&o->lock);
+}
+
+// stream the (projected) tuples matching q back to the client
+
+static void doQuery(Conn *c, Reln r, char *q, char *attrs, char *opts)
+{
+	char row[MAXTUPLEN + 1];
+	uint64_t n = 0;
+
+	if (strlen(attrs) >= MAXTUPLEN) {
+		reply(c, 'E', "invalid projection");
+		return;
+	}
+	strcpy(row, attrs);
+	Projection p = startProjectionOpts(r, row, opts);
+	if (p == NULL) {
+		reply(c, 'E', "invalid projection");
+		return;
+	}
+	Selection s = startSelection(r, q);
+	while (!c->dead && getNextProjected(s, p, row)) {
+		addRow(c, row, strlen(row));
+		n++;
+	}
+	closeSelection(s);
+	closeProjection(p);
+	if (c->used > 0) sendFrame(c, 'T', c->out, c->used);
+	reply(c, 'K', "%"PRIu64, n);
+}
+
+// send the relation's statistics (see relationStatsJSON())
+
+static void doStats(Conn *c, Reln r)
+{
+	char *json;
+	size_t len;
+	FILE *f = open_memstream(&json, &len);
+	if (f == NULL) {
+		reply(c, 'E', "out of memory");
+		return;
+	}
+	relationStatsJSON(r, f);
+	fclose(f);
+	sendText(c, json, len);
+	free(json);
+	reply(c, 'K', "0");
+}
+
+// send a choice vector for the relation (see adviseChVec())
+
+static void doAdvise(Conn *c, Reln r, char *opts)
+{
+	char cv[CHVECLEN];
+	char *report;
+	size_t len;
+	FILE *f = open_memstream(&report, &len);
+	if (f == NULL) {
+		reply(c, 'E', "out of memory");
+		return;
+	}
+	Status ok = adviseChVec(r, opts, cv, f);
+	fclose(f);
+	if (ok == OK) {
+		sendText(c, report, len);
+		reply(c, 'K', "0");
+	}
+	else
+		reply(c, 'E', "can't advise on relation");
+	free(report);
+}
+
+// replace the relation by a copy with choice vector cv (or, if cv
+// is NULL, the one advised); the copy is made while queries (but
+// not inserts) go on, then the relation is reopened
+// (with -c, the caller holds o->lock, so nothing else goes on)
+
+static void doRebuild(Conn *c, OpenReln *o, char *cv)
+{
+	char advised[CHVECLEN];
+	char *report = NULL;
+	size_t len = 0;
+
+	pthread_rwlock_wrlock(&o->writes);
+	pthread_rwlock_rdlock(&o->handle);
+	Status ok = OK;
+	if (cv == NULL || *cv == '\0') {
+		FILE *f = open_memstream(&report, &len);
+		if (f == NULL) ok = ~OK;
+		else {
+			ok = adviseChVec(o->rel, NULL, advised, f);
+			fclose(f);
+		}
+		cv = advised;
+	}
+	if (ok == OK) ok = rebuildRelation(o->rel, o->name, cv);
+	pthread_rwlock_unlock(&o->handle);
+
+	if (ok == OK) {
+		pthread_rwlock_wrlock(&o->handle);
+		closeRelation(o->rel);
+		o->rel = openRelationOpts(o->name, "r+", relOpts);
+		if (o->rel == NULL) fatal("Can't reopen rebuilt relation");
+		pthread_rwlock_unlock(&o->handle);
+		if (report != NULL) sendText(c, report, len);
+		reply(c, 'K', "%"PRIu64, ntuples(o->rel));
+	}
+	else
+		reply(c, 'E', "can't rebuild relation %s", o->name);
+	pthread_rwlock_unlock(&o->writes);
+	free(report);
+}
+
+// add each tuple (one per line) to the relation
+// stops at the first invalid one (see tupleFits())
+
+static void doInsert(Conn *c, Reln r, char *tuples)
+{
+	uint64_t n = 0;
+	char *t;
+
+	while ((t = nextLine(&tuples)) != NULL) {
+		if (*t == '\0') continue;
+		if (!tupleFits(r, t)) {
+			reply(c, 'E', "invalid tuple after %"PRIu64" inserted: %.40s", n, t);
+			return;
+		}
+		if (addToRelation(r, t) == NO_PAGE) {
+			reply(c, 'E', "insert failed after %"PRIu64" inserted", n);
+			return;
+		}
+		n++;
+	}
+	reply(c, 'K', "%"PRIu64, n);
+}
+
+// the open relation called name, opening it if need be
+// returns NULL if it can't be opened
+
+static OpenReln *findReln(char *name)
+{
+	OpenReln *o = NULL;
+
+	pthread_mutex_lock(&relsLock);
+	for (Count i = 0; i < nrels; i++) {
+		if (strcmp(rels[i].name, name) == 0) {
+			o = &rels[i];
+			break;
+		}
+	}
+	if (o == NULL && nrels < MAXOPEN && strlen(name) < MAXRELNAME
+	    && existsRelation(name)) {
+		Reln r = openRelationOpts(name, "r+", relOpts);
+		if (r != NULL) {
+			o = &rels[nrels++];
+			strcpy(o->name, name);
+			o->rel = r;
+			pthread_mutex_init(&o->lock, NULL);
+			pthread_rwlock_init(&o->writes, NULL);
+			pthread_rwlock_init(&o->handle, NULL);
+		}
+	}
+	pthread_mutex_unlock(&relsLock);
+	return o;
+}
+
+// does t (a tuple or query) have the right number of values?
+
+static Bool validTuple(Reln r, char *t)
+{
+	if (strlen(t) >= MAXTUPLEN) return FALSE;
+	Count n = 1;
+	for (char *c = t; *c != '\0'; c++)
+		if (*c == ',') n++;
+	return n == nattrs(r);
+}
+
+// next '\n'-terminated line in *rest (NULL if none left)
+
+static char *nextLine(char **rest)
+{
+	char *line = *rest;
+	if (line == NULL || *line == '\0') return NULL;
+	char *nl = strchr(line, '\n');
+	if (nl == NULL)
+		*rest = NULL;
+	else {
+		*nl = '\0';
+		*rest = nl + 1;
+	}
+	return line;
+}
+
+
+
+// read a request frame into a new '\0'-terminated buffer
+// returns FALSE at end of input or on a bad frame
+
+static Bool readFrame(int fd, char **buf)
+{
+	uint32_t len;
+	if (!readAll(fd, &len, sizeof(len))) return FALSE;
+	len = ntohl(len);
+	if (len > MAXFRAME) return FALSE;
+	*buf = malloc(len + 1);
+	assert(*buf != NULL);
+	if (!readAll(fd, *buf, len)) {
+		free(*buf);
+		return FALSE;
+	}
+	(*buf)[len] = '\0';
+	return TRUE;
+}
+
+// send a frame: the type byte, then len bytes of data
+
+static void sendFrame(Conn *c, char type, char *data, size_t len)
+{
+	uint32_t n = htonl(len + 1);
+	if (!c->dead && !(writeAll(c->fd, &n, sizeof(n))
+	                  && writeAll(c->fd, &type, 1) && writeAll(c->fd, data, len)))
+		c->dead = TRUE;
+	c->used = 0;
+}
+
+// send text as 'T' frames
+
+static void sendText(Conn *c, char *text, size_t len)
+{
+	for (size_t off = 0; off < len; off += FRAMEDATA)
+		sendFrame(c, 'T', text + off, len - off < FRAMEDATA ? len - off : FRAMEDATA);
+}
+
+// buffer a result row, sending a 'T' frame when the buffer is full
+
+static void addRow(Conn *c, char *row, Count len)
+{
+	if (c->used + len + 1 > FRAMEDATA) sendFrame(c, 'T', c->out, c->used);
+	memcpy(c->out + c->used, row, len);
+	c->out[c->used + len] = '\n';
+	c->used += len + 1;
+}
+
+// send a 'K' or 'E' frame, with a printf-style message
+
+static void reply(Conn *c, char type, char *fmt, ...)
+{
+	char msg[MAXERRMSG];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	sendFrame(c, type, msg, strlen(msg));
+}
+
+static Bool readAll(int fd, void *buf, size_t n)
+{
+	char *b = buf;
+	while (n > 0) {
+		ssize_t k = read(fd, b, n);
+		if (k < 0 && errno == EINTR) continue;
+		if (k <= 0) return FALSE;
+		b += k;
+		n -= k;
+	}
+	return TRUE;
+}
+
+static Bool writeAll(int fd, void *buf, size_t n)
+{
+	char *b = buf;
+	while (n > 0) {
+		ssize_t k = write(fd, b, n);
+		if (k < 0 && errno == EINTR) continue;
+		if (k <= 0) return FALSE;
+		b += k;
+		n -= k;
+	}
+	return TRUE;
+}
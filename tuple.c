@@ -3,6 +3,7 @@
 // Credt: John Shepherd
 // Last modified by Xiangjun Zai, 24/03/2024
 
+#include <math.h>
 #include "defs.h"
 #include "tuple.h"
 #include "reln.h"
@@ -10,6 +11,7 @@
 #include "chvec.h"
 #include "bits.h"
 #include "util.h"
+#include "delim.h"
 
 
 
@@ -46,32 +48,63 @@ Tuple readTuple(Reln r, FILE *in)
 		if (*c == ',') nf++;
 	// invalid tuple
 	if (nf != nattrs(r)) return NULL;
+	// value not of its attribute's type (typed relations)
+	if (attrTypes(r) != NULL && !tupleFits(r, line)) return NULL;
 	return copyString(line); // needs to be free'd sometime
 }
 
+// does t have a value for each attribute of r, of the attribute's
+// type (if r has a schema; see schema.c)?
+
+Bool tupleFits(Reln r, Tuple t)
+{
+	AttrType *types = attrTypes(r);
+	Count n = 1;
+	for (char *c = t; *c != '\0'; c++)
+		if (*c == ',') n++;
+	if (n != nattrs(r) || strlen(t) >= MAXTUPLEN) return FALSE;
+	if (types == NULL) return TRUE;
+	char enc[MAXENCLEN];
+	return encodeTuple(types, n, t, enc) > 0;
+}
+
 // extract values into an array of strings
 
 void tupleVals(Tuple t, char **vals)
 {
-	char *c = t, *c0 = t;
-	int i = 0;
-	for (;;) {
-		while (*c != ',' && *c != '\0') c++;
-		if (*c == '\0') {
-			// end of tuple; add last field to vals
-			vals[i++] = copyString(c0);
-			break;
-		}
-		else {
-			// end of next field; add to vals
-			*c = '\0';
-			vals[i++] = copyString(c0);
-			*c = ',';
-			c++; c0 = c;
-		}
+	Count len = strlen(t);
+	Count pos[MAXATTRS];
+	Count nc = findCommas(t, len, pos, MAXATTRS - 1);
+	Count start = 0;
+	for (Count i = 0; i <= nc; i++) {
+		Count end = (i < nc) ? pos[i] : len;
+		vals[i] = malloc(end - start + 1);
+		assert(vals[i] != NULL);
+		memcpy(vals[i], t + start, end - start);
+		vals[i][end - start] = '\0';
+		start = end + 1;
 	}
 }
 
+// split a tuple in place into its attribute values
+// (each ',' is replaced by '\0'; vals[] point into t)
+// returns the number of values found (at most max)
+
+Count splitTuple(char *t, char **vals, Count max)
+{
+	Count n = 0;
+	if (max == 0) return 0;
+	Count pos[max];
+	Count nc = findCommas(t, strlen(t), pos, max);
+	vals[n++] = t;
+	for (Count k = 0; k < nc; k++) {
+		t[pos[k]] = '\0';
+		if (n == max) break;
+		vals[n++] = t + pos[k] + 1;
+	}
+	return n;
+}
+
 // release memory used for separate attribute values
 
 void freeVals(char **vals, int nattrs)
@@ -88,48 +121,66 @@ void freeVals(char **vals, int nattrs)
 EDITTED 
 **************************/
 // hash a tuple using the choice vector
-// TODO: actually use the choice vector to make the hash
+// each attribute that contributes at least one choice vector
+// bit is hashed once, directly from the tuple (no copying),
+// using the relation's hash function family (see attrHash())
 
 Bits tupleHash(Reln r, Tuple t)
 {	
 	Bits hash = 0;
-	
-	
-	
 	Count nvals = nattrs(r);
-    char **vals = malloc(nvals*sizeof(char *));
-    assert(vals != NULL);
-    tupleVals(t, vals);
 	ChVecItem * cv = chvec(r);
+	AttrType *types = attrTypes(r);
+	int fn = hashfn(r);
 
 	// NEW
 	// CALCULATE MULTI_ATTRIBUTE HASH
-	// because 1 attributes might contributes >= 0 bit	
-	// loop through attributes first
-	for (int i = 0; i < nvals; i ++) {
-		Bits attr_hash = 0;
-		//loop through the choice vector
-		//only calculate attr_hash if it is needed for at least 1 bit 
-		for (int j = 0; j < MAXCHVEC; j ++) { 
-			if (cv[j].att == i) {
-				attr_hash = hash_any((unsigned char *)vals[i],strlen(vals[i]));
-				break;
-			}
-		}
-		// get all the bits from attribute i
-		for (int j = 0; j < MAXCHVEC; j++) {
-			if ((cv[j].att == i) && bitIsSet(attr_hash, cv[j].bit)) hash = setBit(hash, j);
-		}
+	// because 1 attributes might contributes >= 0 bit
+	// first find which attributes are needed at all
+	Bool used[nvals];
+	memset(used, FALSE, nvals);
+	for (int j = 0; j < MAXCHVEC; j++) used[cv[j].att] = TRUE;
+
+	// then hash each needed attribute in place
+	// (its ','s are found in bulk first; see delim.c)
+	Bits attr_hash[nvals];
+	memset(attr_hash, 0, sizeof(attr_hash));
+	Count len = strlen(t);
+	Count pos[nvals];
+	Count nc = findCommas(t, len, pos, nvals);
+	Count start = 0;
+	for (int i = 0; i <= nc && i < nvals; i++) {
+		Count end = (i < nc) ? pos[i] : len;
+		if (used[i] && types != NULL)
+			attr_hash[i] = valueHash(fn, types[i], t + start, end - start);
+		else if (used[i])
+			attr_hash[i] = hashValue(fn, (unsigned char *)t + start, end - start);
+		start = end + 1;
+	}
+
+	// get all the bits from each attribute
+	for (int j = 0; j < MAXCHVEC; j++) {
+		if (bitIsSet(attr_hash[cv[j].att], cv[j].bit)) hash = setBit(hash, j);
 	}
 
 	//char buf[MAXBITS+5];  //*** for debug
 	//bitsString(hash,buf);  //*** for debug
 	//printf("hash(%s) = %s\n", t, buf);  //*** for debug
 
-    freeVals(vals,nvals);
 	return hash;
 }
 
+// hash the len-char value v of attribute a, as tupleHash() does:
+// with the relation's hash function family, and (if the relation
+// has a schema) in the binary form of the attribute's type
+
+Bits attrHash(Reln r, Count a, char *v, Count len)
+{
+	AttrType *types = attrTypes(r);
+	if (types != NULL) return valueHash(hashfn(r), types[a], v, len);
+	return hashValue(hashfn(r), (unsigned char *)v, len);
+}
+
 
 
 
@@ -183,8 +234,10 @@ static Bool strMatch(char* p, char* s) {
 	else {
 		// if there is at least 1 unknown section
 		// have to gather all known sections in pattern in order
-		// put them in an array of string (pat)
-		char** pat =  malloc(n_kn*sizeof(char *));
+		// (where each starts in p, and its length; nothing is copied,
+		// so matching allocates no memory)
+		char* pat[n_kn];
+		int patlen[n_kn];
 		int j = 0;
 		last = -1;
 		for (int i = 0; i <= plen; i ++) {
@@ -192,10 +245,8 @@ static Bool strMatch(char* p, char* s) {
 				// if there is space between last and current '%'
 				if (i > last + 1) {
 					// add the known section to the pat array
-					int slen = i - last - 1;
-					pat[j] = (char *)malloc(sizeof(char) * (slen + 1));
-					memcpy(pat[j], p + last + 1, slen);
-					pat[j][slen] = '\0';
+					pat[j] = p + last + 1;
+					patlen[j] = i - last - 1;
 					j++;
 				}
 				//update last
@@ -210,18 +261,14 @@ static Bool strMatch(char* p, char* s) {
 
 		result = 0;
 		j = 0;
-		char temp[MAXTUPLEN];
 
 		for (int i = 0; i < n_kn; i ++) {
 			//look for first occurence of pat[i] in s
 			Bool found = FALSE;
-			int sublen = strlen(pat[i]);
+			int sublen = patlen[i];
 			while ((found == FALSE) && (sublen <= slen - j)) {
-				//copy the next block of s into temp
-				memcpy(temp, s + j, sizeof(char)*sublen);
-				temp[sublen] = '\0';
-				// if there is a match
-				if (strcmp(temp, pat[i]) == 0) {
+				// if the next block of s is a match
+				if (memcmp(s + j, pat[i], sublen) == 0) {
 					// check if the subpattern is an "inflexible" known section at the beginning of pattern
 					// or at the end of the pattern
 					if ((i == 0) && (knownStart == 0) && (j != 0)) 
@@ -244,8 +291,6 @@ static Bool strMatch(char* p, char* s) {
 				break;
 			}		
 		}
-		//free everything that needs to be freed
-		freeVals(pat, n_kn);
 	}
 
 	// now return
@@ -264,30 +309,91 @@ NEW FUNC
 - return the matching result
 - can be used by other file
 - declared in tuple.h file
+- the tuple is split in a copy on the stack (no memory is allocated)
 *****************************************************************/
 Bool tupValMatch(Count nAttr, char **ptv, Tuple t) {
 	
-	char **v = malloc(nAttr*sizeof(char *));
-	tupleVals(t, v);
+	char buf[strlen(t) + 1];
+	char *v[nAttr];
+	strcpy(buf, t);
+	if (splitTuple(buf, v, nAttr) < nAttr) return FALSE;
 	Bool match = TRUE;
 
 	for (int i = 0; i < nAttr; i++) {
-		if ((ptv[i][0] == '?') && (ptv[i][1] == '\0')) 
-			continue;
-		else {
-			match = strMatch(ptv[i], v[i]);
-			if (match != TRUE) break;
-		}
+		match = attrMatch(ptv[i], v[i]);
+		if (match != TRUE) break;
 	}
 
-	freeVals(v, nAttr);
-
 	return match;
 
 }
 
 
 
+/**************************************************************
+NEW FUNC
+- given one pattern value ('?', a string with '%'s, or a plain string)
+- and one attribute value, return the matching result
+*****************************************************************/
+Bool attrMatch(char *pv, char *v) {
+
+	double lo, hi;
+	if ((pv[0] == '?') && (pv[1] == '\0'))
+		return TRUE;
+	if (isRange(pv, &lo, &hi))
+		return rangeMatch(v, lo, hi);
+	return strMatch(pv, v);
+}
+
+
+
+/*NEW FUNC*/
+// does a value look like a number? if so, set *x to it
+
+Bool numericValue(char *v, double *x)
+{
+	char *end;
+	*x = strtod(v, &end);
+	return (end != v && *end == '\0');
+}
+
+
+
+/*NEW FUNC*/
+// is a query value a range "lo..hi" (inclusive)?
+// both bounds must be numbers (not NaN), otherwise the value is
+// just a value, matched by equality: "..", "1.." and "a..b" are
+// not ranges; for an open end, use "-inf" or "inf" ("10..inf")
+// a value that is a range ("1..2") can't be matched by equality
+// sets *lo and *hi if it is a range
+
+Bool isRange(char *pv, double *lo, double *hi)
+{
+	char *dots = strstr(pv, "..");
+	if (dots == NULL || dots == pv || dots[2] == '\0') return FALSE;
+	char buf[MAXTUPLEN];
+	Count n = dots - pv;
+	if (n >= MAXTUPLEN) return FALSE;
+	memcpy(buf, pv, n);
+	buf[n] = '\0';
+	if (!numericValue(buf, lo) || isnan(*lo)) return FALSE;
+	if (!numericValue(dots + 2, hi) || isnan(*hi)) return FALSE;
+	return TRUE;
+}
+
+
+
+/*NEW FUNC*/
+// a range matches values that look like numbers within it
+
+Bool rangeMatch(char *v, double lo, double hi)
+{
+	double x;
+	return numericValue(v, &x) && x >= lo && x <= hi;
+}
+
+
+
 
 /************************
 EDITED
@@ -297,13 +403,13 @@ EDITED
 Bool tupleMatch(Reln r, Tuple pt, Tuple t)
 {
 	Count na = nattrs(r);
-	char **ptv = malloc(na*sizeof(char *));
-	tupleVals(pt, ptv);
+	char buf[strlen(pt) + 1];
+	char *ptv[na];
+	strcpy(buf, pt);
+	for (Count n = splitTuple(buf, ptv, na); n < na; n++) ptv[n] = "?";
 
 
 	Bool match = tupValMatch(na, ptv, t);
-
-	freeVals(ptv,na); 
 	
 	//if (match == TRUE) printf("tuple.c tupleMatch FOUND A MATCH: query = '%s' + tup = '%s' \n", pt, t); //for debug
 
@@ -328,3 +434,56 @@ void freeTuple(Tuple t)
         free(t);
     }
 }
+
+// make a batch that holds up to max tuples
+
+TupleBatch *newTupleBatch(Count max)
+{
+	assert(max > 0);
+	TupleBatch *b = malloc(sizeof(TupleBatch));
+	assert(b != NULL);
+	b->max = max;
+	b->tuples = malloc(max * sizeof(char *));
+	b->lens = malloc(max * sizeof(Count));
+	b->data = malloc(max * MAXTUPLEN);
+	assert(b->tuples != NULL && b->lens != NULL && b->data != NULL);
+	clearTupleBatch(b);
+	return b;
+}
+
+// empty a batch (ready to be refilled)
+
+void clearTupleBatch(TupleBatch *b)
+{
+	b->ntuples = 0;
+	b->used = 0;
+}
+
+// where the next tuple in the batch is to be written
+// (there is room for MAXTUPLEN chars as long as the batch is not full)
+
+char *batchSpace(TupleBatch *b)
+{
+	assert(b->ntuples < b->max);
+	return b->data + b->used;
+}
+
+// add the len-char tuple just written at batchSpace(b) to the batch
+
+void batchAdd(TupleBatch *b, Count len)
+{
+	assert(len < MAXTUPLEN);
+	b->tuples[b->ntuples] = b->data + b->used;
+	b->lens[b->ntuples] = len;
+	b->ntuples++;
+	b->used += len + 1;
+}
+
+void freeTupleBatch(TupleBatch *b)
+{
+	if (b == NULL) return;
+	free(b->tuples);
+	free(b->lens);
+	free(b->data);
+	free(b);
+}
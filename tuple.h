@@ -11,22 +11,47 @@
 
 typedef char *Tuple;
 
+// a batch of tuples, owned by the caller and refilled by
+// getNextBatch() (see select.c) or projectBatch() (see project.c)
+// tuples[i] is a '\0'-terminated span of lens[i] chars inside data
+
+typedef struct TupleBatch {
+	Count  max;       // capacity (#tuples)
+	Count  ntuples;   // #tuples currently in batch
+	char   **tuples;  // start of each tuple
+	Count  *lens;     // length of each tuple
+	char   *data;     // tuple text (max*MAXTUPLEN bytes)
+	Count  used;      // #bytes of data in use
+} TupleBatch;
+
 #include "reln.h"
 #include "bits.h"
 
 int tupLength(Tuple t);
 Tuple readTuple(Reln r, FILE *in);
+Bool tupleFits(Reln r, Tuple t);
 Bits tupleHash(Reln r, Tuple t);
+Bits attrHash(Reln r, Count a, char *v, Count len);
 void tupleVals(Tuple t, char **vals);
+Count splitTuple(char *t, char **vals, Count max);
 void freeVals(char **vals, int nattrs);
 Bool tupleMatch(Reln r, Tuple pt, Tuple t);
 void tupleString(Tuple t, char *buf);
 void freeTuple(Tuple t); //** release memory used for tuple
+TupleBatch *newTupleBatch(Count max);
+void clearTupleBatch(TupleBatch *b);
+char *batchSpace(TupleBatch *b);
+void batchAdd(TupleBatch *b, Count len);
+void freeTupleBatch(TupleBatch *b);
 
 
 
 
 /*NEW FUNC*/
 Bool tupValMatch(Count nAttr, char **ptv, Tuple t);
+Bool attrMatch(char *pv, char *v);
+Bool numericValue(char *v, double *x);
+Bool isRange(char *pv, double *lo, double *hi);
+Bool rangeMatch(char *v, double lo, double hi);
 
 #endif
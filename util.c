@@ -20,3 +20,18 @@ char *copyString(char *str)
 	strcpy(new, str);
 	return new;
 }
+
+// read a size in bytes, with an optional k or m suffix (e.g. "64k")
+// returns 0, or -1 if str isn't a size
+
+int parseSize(char *str, size_t *n)
+{
+	char *end;
+	unsigned long long v = strtoull(str, &end, 10);
+	if (end == str) return -1;
+	if (*end == 'k' || *end == 'K') { v <<= 10; end++; }
+	else if (*end == 'm' || *end == 'M') { v <<= 20; end++; }
+	if (*end != '\0') return -1;
+	*n = v;
+	return 0;
+}
@@ -7,7 +7,10 @@
 #ifndef UTIL_H
 #define UTIL_H 1
 
+#include <stddef.h>
+
 void fatal(char *);
 char *copyString(char *);
+int parseSize(char *, size_t *);
 
 #endif